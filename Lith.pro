@@ -7,6 +7,16 @@ QT += qml quick widgets multimedia quickcontrols2 xml gui-private websockets
 
 CONFIG += c++17
 
+# relay messages are decompressed as they arrive, Qt provides zlib either bundled or from the system
+QT += zlib-private
+
+# zstd is preferred when the relay supports it (WeeChat 3.5 and newer), zlib is the fallback
+packagesExist(libzstd) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libzstd
+    DEFINES += HAVE_ZSTD
+}
+
 HEADERS += \
     src/clipboardproxy.h \
     src/datamodel.h \
@@ -22,7 +32,18 @@ HEADERS += \
     src/common.h \
     src/windowhelper.h \
     src/util/colortheme.h \
-    src/util/sockethelper.h
+    src/util/command.h \
+    src/util/connectionmetrics.h \
+    src/util/inflater.h \
+    src/util/reconnectpolicy.h \
+    src/util/requestcatalogue.h \
+    src/util/requestregistry.h \
+    src/util/ringbuffer.h \
+    src/util/rttestimator.h \
+    src/util/sockethelper.h \
+    src/util/syncmanager.h \
+    src/util/tracefile.h \
+    src/util/zstddecoder.h
 
 SOURCES += \
     src/lith.cpp \
@@ -39,7 +60,18 @@ SOURCES += \
     src/weechat.cpp \
     src/windowhelper.cpp \
     src/util/colortheme.cpp \
-    src/util/sockethelper.cpp
+    src/util/command.cpp \
+    src/util/connectionmetrics.cpp \
+    src/util/inflater.cpp \
+    src/util/reconnectpolicy.cpp \
+    src/util/requestcatalogue.cpp \
+    src/util/requestregistry.cpp \
+    src/util/ringbuffer.cpp \
+    src/util/rttestimator.cpp \
+    src/util/sockethelper.cpp \
+    src/util/syncmanager.cpp \
+    src/util/tracefile.cpp \
+    src/util/zstddecoder.cpp
 
 
 INCLUDEPATH += \
@@ -28,6 +28,130 @@
 #include <QXmlStreamReader>
 #include <QDomDocument>
 
+// TODO this is probably wrong
+static QString nickFromPrefix(const FormattedString &prefix) {
+    auto plain = prefix.toPlain();
+    if (plain.startsWith("@") || plain.startsWith("+"))
+        return plain.mid(1);
+    return plain;
+}
+
+static void flagsFromTags(const QStringList &tags, bool &isJoinPartQuitMsg, bool &isPrivMsg, bool &isSelfMsg) {
+    isJoinPartQuitMsg = false;
+    isPrivMsg = false;
+    isSelfMsg = false;
+    for (auto &tag : tags) {
+        if (tag == QLatin1String("irc_quit") || tag == QLatin1String("irc_join") || tag == QLatin1String("irc_part"))
+            isJoinPartQuitMsg = true;
+        else if (tag == QLatin1String("irc_privmsg"))
+            isPrivMsg = true;
+        else if (tag == QLatin1String("self_msg"))
+            isSelfMsg = true;
+    }
+}
+
+LineBatch LineData::fromHData(const Protocol::HData &hda) {
+    using Type = Protocol::HData::Type;
+    // buffer - lines - line - line_data or just line_data, the buffer is in the data either way
+    const int buffer = hda.fieldIndex("buffer", Type::Pointer);
+    const int date = hda.fieldIndex("date", Type::Time);
+    const int displayed = hda.fieldIndex("displayed", Type::Char);
+    const int highlight = hda.fieldIndex("highlight", Type::Char);
+    const int tags = hda.fieldIndex("tags_array", Type::Array);
+    const int prefix = hda.fieldIndex("prefix", Type::String);
+    const int message = hda.fieldIndex("message", Type::String);
+    // the line is right above its data in the path
+    const int linePath = hda.path.count() >= 2 && hda.path[hda.path.count() - 2] == "line" ? hda.path.count() - 2 : -1;
+
+    LineBatch batch;
+    batch.continued = hda.continued;
+    batch.items.reserve(hda.count);
+    for (int i = 0; i < hda.count; i++) {
+        LineData line;
+        line.buffer = buffer >= 0 ? hda.pointerValue(i, buffer) : hda.firstPointer(i);
+        line.ptr = hda.lastPointer(i);
+        if (linePath >= 0)
+            line.line = hda.pointer(i, linePath);
+        if (date >= 0)
+            line.date = hda.time(i, date);
+        if (displayed >= 0)
+            line.displayed = hda.character(i, displayed);
+        if (highlight >= 0)
+            line.highlight = hda.character(i, highlight);
+        if (tags >= 0)
+            line.tags_array = hda.arrayStr(i, tags);
+        if (prefix >= 0)
+            line.prefix = hda.string(i, prefix);
+        if (message >= 0)
+            line.message = hda.string(i, message);
+        line.nick = nickFromPrefix(line.prefix);
+        flagsFromTags(line.tags_array, line.isJoinPartQuitMsg, line.isPrivMsg, line.isSelfMsg);
+        batch.items.push_back(std::move(line));
+    }
+    return batch;
+}
+
+NickBatch NickData::fromHData(const Protocol::HData &hda) {
+    using Type = Protocol::HData::Type;
+    const int diff = hda.fieldIndex("_diff", Type::Char);
+    const int visible = hda.fieldIndex("visible", Type::Char);
+    const int group = hda.fieldIndex("group", Type::Char);
+    const int level = hda.fieldIndex("level", Type::Integer);
+    const int name = hda.fieldIndex("name", Type::String);
+    const int color = hda.fieldIndex("color", Type::String);
+    const int prefix = hda.fieldIndex("prefix", Type::String);
+    const int prefixColor = hda.fieldIndex("prefix_color", Type::String);
+
+    NickBatch batch;
+    batch.continued = hda.continued;
+    batch.items.reserve(hda.count);
+    for (int i = 0; i < hda.count; i++) {
+        // buffer - nicklist_item
+        NickData nick;
+        nick.buffer = hda.firstPointer(i);
+        nick.ptr = hda.lastPointer(i);
+        if (diff >= 0)
+            nick.diff = hda.character(i, diff);
+        if (visible >= 0)
+            nick.visible = hda.character(i, visible);
+        if (group >= 0)
+            nick.group = hda.character(i, group);
+        if (level >= 0)
+            nick.level = hda.integer(i, level);
+        if (name >= 0)
+            nick.name = hda.string(i, name);
+        if (color >= 0)
+            nick.color = hda.string(i, color);
+        if (prefix >= 0)
+            nick.prefix = hda.string(i, prefix);
+        if (prefixColor >= 0)
+            nick.prefix_color = hda.string(i, prefixColor);
+        batch.items.push_back(std::move(nick));
+    }
+    return batch;
+}
+
+HotListBatch HotListData::fromHData(const Protocol::HData &hda) {
+    using Type = Protocol::HData::Type;
+    const int buffer = hda.fieldIndex("buffer", Type::Pointer);
+    const int count = hda.fieldIndex("count", Type::Array);
+
+    HotListBatch batch;
+    batch.continued = hda.continued;
+    batch.items.reserve(hda.count);
+    for (int i = 0; i < hda.count; i++) {
+        // hotlist
+        HotListData item;
+        item.ptr = hda.firstPointer(i);
+        if (buffer >= 0)
+            item.buffer = hda.pointerValue(i, buffer);
+        if (count >= 0)
+            item.count = hda.arrayInt(i, count);
+        batch.items.push_back(std::move(item));
+    }
+    return batch;
+}
+
 Buffer::Buffer(Lith *parent, pointer_t pointer)
     : QObject(parent)
     , m_lines(QmlObjectList::create<BufferLine>(this))
@@ -55,6 +179,36 @@ void Buffer::appendLine(BufferLine *line) {
     m_lines->append(line);
 }
 
+void Buffer::insertLine(int index, BufferLine *line) {
+    m_lines->insert(index, line);
+}
+
+void Buffer::clearLines(int from) {
+    resetPaging();
+    from = qMax(from, 0);
+    // Lith has to forget them too, otherwise fetching them again would skip them as known
+    for (int i = from; i < m_lines->count(); i++) {
+        auto line = m_lines->get<BufferLine>(i);
+        if (line)
+            lith()->removeLine(m_ptr, line->ptrGet());
+    }
+    // the list holds the lines in shared pointers, dropping them deletes them
+    if (from == 0) {
+        m_lines->clear();
+        return;
+    }
+    while (m_lines->count() > from)
+        m_lines->removeLast();
+}
+
+pointer_t Buffer::ptrGet() const {
+    return m_ptr;
+}
+
+void Buffer::ptrSet(pointer_t ptr) {
+    m_ptr = ptr;
+}
+
 FormattedString Buffer::titleGet() const {
     return m_title;
 }
@@ -192,15 +346,9 @@ MessageFilterList *Buffer::lines_filtered() {
 bool Buffer::input(const QString &data) {
     if (Lith::instance()->statusGet() == Lith::CONNECTED) {
         bool success = false;
-        QList<bool> success_list;
-
-        auto data_split = data.split(QRegularExpression("\n|\r\n|\r"));
-
-        for (auto &data_single_line : data_split) {
-            QMetaObject::invokeMethod(Lith::instance()->weechat(), "input", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, success), Q_ARG(pointer_t, m_ptr), Q_ARG(QString, data_single_line));
-            success_list.append(success);
-        }
-        return !success_list.contains(false);
+        // multiple lines are split into separate commands in Weechat::input, all sent at once
+        QMetaObject::invokeMethod(Lith::instance()->weechat(), "input", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, success), Q_ARG(pointer_t, m_ptr), Q_ARG(QString, data));
+        return success;
     }
     return false;
     //Lith::instance()->weechat()->input(m_ptr, data);
@@ -208,13 +356,58 @@ bool Buffer::input(const QString &data) {
 
 void Buffer::fetchMoreLines() {
     m_afterInitialFetch = true;
+    if (m_historyStart)
+        return;
+    auto cursor = oldestLinePtr();
+    if (cursor) {
+        // one page at a time, the next one continues from wherever the reply leaves the oldest line
+        if (m_pageCursor)
+            return;
+        m_pageCursor = cursor;
+        QMetaObject::invokeMethod(Lith::instance()->weechat(), "fetchLinesBefore", Q_ARG(pointer_t, m_ptr), Q_ARG(pointer_t, m_pageCursor), Q_ARG(int, nextPageSize()), Q_ARG(int, m_lines->count()));
+        return;
+    }
+    // nothing to continue from, the whole tail it is
     if (m_lines->count() >= m_lastRequestedCount) {
-        QMetaObject::invokeMethod(Lith::instance()->weechat(), "fetchLines", Q_ARG(pointer_t, m_ptr), Q_ARG(int, m_lines->count() + 25));
+        auto count = m_lines->count() + nextPageSize();
+        QMetaObject::invokeMethod(Lith::instance()->weechat(), "fetchLines", Q_ARG(pointer_t, m_ptr), Q_ARG(int, count));
         //Lith::instance()->weechat()->fetchLines(m_ptr, m_lines->count() + 25);
-        m_lastRequestedCount = m_lines->count() + 25;
+        m_lastRequestedCount = count;
     }
 }
 
+void Buffer::resetPaging() {
+    m_pageCursor = 0;
+    m_historyStart = false;
+    m_lastRequestedCount = 0;
+}
+
+void Buffer::pageFetched(pointer_t cursor, bool historyStart) {
+    // a reply to a page asked for before the paging was reset
+    if (cursor != m_pageCursor)
+        return;
+    m_pageCursor = 0;
+    m_historyStart = historyStart;
+}
+
+pointer_t Buffer::oldestLinePtr() const {
+    for (int i = m_lines->count() - 1; i >= 0; i--) {
+        auto line = m_lines->get<BufferLine>(i);
+        if (line && line->linePtrGet())
+            return line->linePtrGet();
+    }
+    return 0;
+}
+
+int Buffer::nextPageSize() {
+    if (m_lastPage.isValid() && m_lastPage.elapsed() < c_fastScrollInterval)
+        m_pageSize = qMin(m_pageSize * 2, c_maxPageSize);
+    else if (!m_lastPage.isValid() || m_lastPage.elapsed() > c_slowScrollInterval)
+        m_pageSize = c_minPageSize;
+    m_lastPage.start();
+    return m_pageSize;
+}
+
 void Buffer::clearHotlist() {
     input("/buffer set hotlist -1");
     unreadMessagesSet(0);
@@ -232,6 +425,24 @@ BufferLine::BufferLine(Buffer *parent)
     connect(Lith::instance()->windowHelperGet(), &WindowHelper::themeChanged, this, &BufferLine::prefixChanged);
 }
 
+BufferLine::BufferLine(Buffer *parent, LineData &&data)
+    : BufferLine(parent)
+{
+    // nothing can be listening to the change signals yet, fill the members directly
+    m_date = std::move(data.date);
+    m_displayed = data.displayed;
+    m_highlight = data.highlight;
+    m_tags_array = std::move(data.tags_array);
+    m_prefix = std::move(data.prefix);
+    m_message = std::move(data.message);
+    m_nick = std::move(data.nick);
+    m_isJoinPartQuitMsg = data.isJoinPartQuitMsg;
+    m_isPrivMsg = data.isPrivMsg;
+    m_isSelfMsg = data.isSelfMsg;
+    m_ptr = data.ptr;
+    m_linePtr = data.line;
+}
+
 BufferLine::~BufferLine() {
 }
 
@@ -249,16 +460,18 @@ FormattedString BufferLine::prefixGet() const {
     return m_prefix;
 }
 
+void BufferLine::tags_arraySet(const QStringList &o) {
+    if (m_tags_array != o) {
+        m_tags_array = o;
+        flagsFromTags(m_tags_array, m_isJoinPartQuitMsg, m_isPrivMsg, m_isSelfMsg);
+        emit tags_arrayChanged();
+    }
+}
+
 void BufferLine::prefixSet(const FormattedString &o) {
     if (m_prefix != o) {
         m_prefix = o;
-        // TODO this is probably wrong
-        if (m_prefix.toPlain().startsWith("@") || m_prefix.toPlain().startsWith("+")) {
-            m_nick = m_prefix.toPlain().mid(1);
-        }
-        else {
-            m_nick = m_prefix.toPlain();
-        }
+        m_nick = nickFromPrefix(m_prefix);
         emit prefixChanged();
     }
 }
@@ -279,15 +492,15 @@ void BufferLine::messageSet(const FormattedString &o) {
 }
 
 bool BufferLine::isSelfMsgGet() {
-    return m_tags_array.contains("self_msg");
+    return m_isSelfMsg;
 }
 
 bool BufferLine::isPrivMsgGet() {
-    return m_tags_array.contains("irc_privmsg");
+    return m_isPrivMsg;
 }
 
 bool BufferLine::isJoinPartQuitMsgGet() {
-    return m_tags_array.contains("irc_quit") || m_tags_array.contains("irc_join") || m_tags_array.contains("irc_part");
+    return m_isJoinPartQuitMsg;
 }
 
 QString BufferLine::colorlessNicknameGet() {
@@ -303,15 +516,47 @@ QObject *BufferLine::bufferGet() {
     return parent();
 }
 
+pointer_t BufferLine::ptrGet() const {
+    return m_ptr;
+}
+
+pointer_t BufferLine::linePtrGet() const {
+    return m_linePtr;
+}
+
 Nick::Nick(Buffer *parent)
     : QObject(parent)
 {
 
 }
 
+Nick::Nick(Buffer *parent, const NickData &data)
+    : QObject(parent)
+    , m_visible(data.visible)
+    , m_group(data.group)
+    , m_level(data.level)
+    , m_name(data.name)
+    , m_color(data.color)
+    , m_prefix(data.prefix)
+    , m_prefix_color(data.prefix_color)
+    , m_ptr(data.ptr)
+{
+
+}
+
 Nick::~Nick() {
 }
 
+void Nick::update(const NickData &data) {
+    visibleSet(data.visible);
+    groupSet(data.group);
+    levelSet(data.level);
+    nameSet(data.name);
+    colorSet(data.color);
+    prefixSet(data.prefix);
+    prefix_colorSet(data.prefix_color);
+}
+
 HotListItem::HotListItem(QObject *parent)
     : QObject(parent)
 {
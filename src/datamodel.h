@@ -28,6 +28,7 @@
 #include <QAbstractListModel>
 #include <QSet>
 #include <QPointer>
+#include <QElapsedTimer>
 
 class Buffer;
 class BufferLine;
@@ -35,6 +36,70 @@ class LineModel;
 class Lith;
 
 #include <cstdint>
+#include <vector>
+
+// A move-only batch of records built from one hdata message (or one part of it)
+template <typename T>
+struct RecordBatch {
+    RecordBatch() = default;
+    RecordBatch(RecordBatch &&) = default;
+    RecordBatch &operator=(RecordBatch &&) = default;
+    RecordBatch(const RecordBatch &) = delete;
+    RecordBatch &operator=(const RecordBatch &) = delete;
+
+    std::vector<T> items;
+    // set when a previous batch of the same message was already delivered
+    bool continued { false };
+};
+
+// Plain records built on the relay thread, the GUI thread only turns them into the QObjects below
+struct LineData {
+    static RecordBatch<LineData> fromHData(const Protocol::HData &hda);
+
+    pointer_t buffer { 0 };
+    pointer_t ptr { 0 };
+    // the line the data belongs to, history paging continues from it; 0 when the message doesn't say
+    pointer_t line { 0 };
+    QDateTime date;
+    bool displayed { false };
+    bool highlight { false };
+    QStringList tags_array;
+    FormattedString prefix;
+    FormattedString message;
+    // derived from the above
+    QString nick;
+    bool isJoinPartQuitMsg { false };
+    bool isPrivMsg { false };
+    bool isSelfMsg { false };
+};
+
+struct NickData {
+    static RecordBatch<NickData> fromHData(const Protocol::HData &hda);
+
+    pointer_t buffer { 0 };
+    pointer_t ptr { 0 };
+    // only in nicklist diffs
+    char diff { 0 };
+    char visible { 0 };
+    char group { 0 };
+    int level { 0 };
+    FormattedString name;
+    QString color;
+    QString prefix;
+    QString prefix_color;
+};
+
+struct HotListData {
+    static RecordBatch<HotListData> fromHData(const Protocol::HData &hda);
+
+    pointer_t ptr { 0 };
+    pointer_t buffer { 0 };
+    QList<int> count;
+};
+
+using LineBatch = RecordBatch<LineData>;
+using NickBatch = RecordBatch<NickData>;
+using HotListBatch = RecordBatch<HotListData>;
 
 class Nick : public QObject {
     Q_OBJECT
@@ -49,8 +114,11 @@ class Nick : public QObject {
     PROPERTY(pointer_t, ptr)
 public:
     Nick(Buffer *parent = nullptr);
+    Nick(Buffer *parent, const NickData &data);
     virtual ~Nick();
 
+    void update(const NickData &data);
+
 };
 
 class Buffer : public QObject {
@@ -84,11 +152,22 @@ public:
     //BufferLine *getLine(pointer_t ptr);
     void prependLine(BufferLine *line);
     void appendLine(BufferLine *line);
+    void insertLine(int index, BufferLine *line);
+    // drops the lines from the index on
+    void clearLines(int from = 0);
+
+    pointer_t ptrGet() const;
+    // the relay can hand out a new pointer for the same buffer after it was restarted
+    void ptrSet(pointer_t ptr);
 
     FormattedString titleGet() const;
     void titleSet(const FormattedString &o);
 
     bool isAfterInitialFetch();
+    // lets the next fetchMoreLines ask again for a page that may have been lost with the connection
+    void resetPaging();
+    // the page asked for before cursor is done with, historyStart when the relay had nothing older
+    void pageFetched(pointer_t cursor, bool historyStart);
 
     QmlObjectList *lines();
     QmlObjectList *nicks();
@@ -123,6 +202,20 @@ private:
     pointer_t m_ptr;
     bool m_afterInitialFetch { false };
     int m_lastRequestedCount { 0 };
+
+    // history is fetched in pages older than the oldest line held, growing while the user keeps scrolling
+    static constexpr int c_minPageSize { 25 };
+    static constexpr int c_maxPageSize { 400 };
+    static constexpr qint64 c_fastScrollInterval { 1000 };
+    static constexpr qint64 c_slowScrollInterval { 5000 };
+    int nextPageSize();
+    // lines from _buffer_line_added don't know their line pointer, paging continues from the oldest one that does
+    pointer_t oldestLinePtr() const;
+    int m_pageSize { c_minPageSize };
+    QElapsedTimer m_lastPage;
+    // the line the page on its way was asked before, 0 when none is
+    pointer_t m_pageCursor { 0 };
+    bool m_historyStart { false };
     FormattedString m_title {};
 };
 
@@ -131,7 +224,7 @@ class BufferLine : public QObject {
     PROPERTY(QDateTime, date)
     PROPERTY(bool, displayed)
     PROPERTY(bool, highlight)
-    PROPERTY(QStringList, tags_array)
+    PROPERTY_NOSETTER(QStringList, tags_array)
 
     Q_PROPERTY(QString nick READ nickGet NOTIFY prefixChanged)
     Q_PROPERTY(FormattedString prefix READ prefixGet WRITE prefixSet NOTIFY prefixChanged)
@@ -145,6 +238,7 @@ class BufferLine : public QObject {
     Q_PROPERTY(QObject *buffer READ bufferGet CONSTANT)
 public:
     BufferLine(Buffer *parent);
+    BufferLine(Buffer *parent, LineData &&data);
     virtual ~BufferLine();
 
     Buffer *buffer();
@@ -152,6 +246,7 @@ public:
 
     void setParent(Buffer *parent);
 
+    void tags_arraySet(const QStringList &o);
     FormattedString prefixGet() const;
     void prefixSet(const FormattedString &o);
     QString nickGet() const;
@@ -165,6 +260,9 @@ public:
     QString colorlessTextGet();
 
     QObject *bufferGet();
+    // the line_data pointer, what Lith knows the line by
+    pointer_t ptrGet() const;
+    pointer_t linePtrGet() const;
 
     QList<QObject*> segments();
 
@@ -179,6 +277,11 @@ private:
     FormattedString m_message;
     FormattedString m_prefix;
     QString m_nick;
+    bool m_isJoinPartQuitMsg { false };
+    bool m_isPrivMsg { false };
+    bool m_isSelfMsg { false };
+    pointer_t m_ptr { 0 };
+    pointer_t m_linePtr { 0 };
 };
 
 class HotListItem : public QObject {
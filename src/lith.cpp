@@ -29,6 +29,7 @@
 #include <QSystemTrayIcon>
 
 #include <QUrl>
+#include <QMetaProperty>
 
 Lith *Lith::_self = nullptr;
 Lith *Lith::instance() {
@@ -71,6 +72,8 @@ void Lith::selectedBufferIndexSet(int index) {
         m_selectedBufferIndex = index;
         emit selectedBufferChanged();
         if (selectedBuffer()) {
+            // goes first, the lines it missed while not synced are in the reply before the ones fetchMoreLines asks for
+            QMetaObject::invokeMethod(m_weechat, "selectBuffer", Q_ARG(pointer_t, selectedBuffer()->ptrGet()));
             selectedBuffer()->fetchMoreLines();
             selectedBuffer()->clearHotlist();
         }
@@ -126,6 +129,7 @@ Lith::Lith(QObject *parent)
     : QObject(parent)
     , m_settings(new Settings(this))
     , m_windowHelper(new WindowHelper(this))
+    , m_metrics(new ConnectionMetrics(this))
 #ifndef Q_OS_WASM
     , m_weechatThread(new QThread(this))
 #endif
@@ -162,139 +166,293 @@ void Lith::resetData() {
     m_hotList.clear();
 }
 
+void Lith::beginResync() {
+    for (auto &buffer : m_bufferMap) {
+        if (buffer)
+            buffer->resetPaging();
+    }
+    m_resyncBuffers.clear();
+    m_resyncHotlist.clear();
+    m_resyncNicks.clear();
+    m_resyncLinesBuffer.clear();
+}
+
+void Lith::endResync() {
+    for (auto ptr : m_bufferMap.keys()) {
+        if (m_resyncBuffers.contains(ptr))
+            continue;
+        // closed while we were away
+        auto buffer = getBuffer(ptr);
+        removeBuffer(ptr);
+        if (buffer)
+            buffer->deleteLater();
+    }
+    for (auto ptr : m_hotList.keys()) {
+        if (m_resyncHotlist.contains(ptr))
+            continue;
+        // read somewhere else in the meantime
+        auto item = m_hotList.take(ptr);
+        if (!item)
+            continue;
+        if (item->bufferGet()) {
+            item->bufferGet()->unreadMessagesSet(0);
+            item->bufferGet()->hotMessagesSet(0);
+        }
+        item->deleteLater();
+    }
+    for (auto &buffer : m_bufferMap) {
+        if (!buffer)
+            continue;
+        auto seen = m_resyncNicks.value(buffer->ptrGet());
+        auto nicks = buffer->nicks();
+        for (int i = nicks->count() - 1; i >= 0; i--) {
+            auto nick = nicks->get<Nick>(i);
+            if (nick && !seen.contains(nick->ptrGet()))
+                buffer->removeNick(nick->ptrGet());
+        }
+    }
+    beginResync();
+    // the pointer may have changed with a restarted relay
+    if (selectedBuffer())
+        QMetaObject::invokeMethod(m_weechat, "selectBuffer", Q_ARG(pointer_t, selectedBuffer()->ptrGet()));
+}
+
 void Lith::reconnect() {
     m_weechat->restart();
 }
 
+namespace {
+// Resolves hdata fields to writable properties of a class once per message
+class PropertyMapping {
+public:
+    PropertyMapping(const QMetaObject &metaObject, const Protocol::HData &hda, const char *skip = nullptr) {
+        for (int j = 0; j < hda.fields.count(); j++) {
+            if (skip && hda.fields[j].name == skip)
+                continue;
+            auto index = metaObject.indexOfProperty(hda.fields[j].name.constData());
+            if (index < 0 || !metaObject.property(index).isWritable())
+                continue;
+            m_properties.append({ j, metaObject.property(index) });
+        }
+    }
+    void apply(QObject *object, const Protocol::HData &hda, int item) const {
+        for (auto &i : m_properties) {
+            i.second.write(object, hda.value(item, i.first));
+        }
+    }
+private:
+    QList<QPair<int, QMetaProperty>> m_properties;
+};
+}
+
 void Lith::handleBufferInitialization(const Protocol::HData &hda) {
-    for (auto &i : hda.data) {
+    PropertyMapping mapping(Buffer::staticMetaObject, hda);
+    for (int i = 0; i < hda.count; i++) {
         // buffer
-        auto ptr = i.pointers.first();
+        auto ptr = hda.firstPointer(i);
         auto b = new Buffer(this, ptr);
-        for (auto j : i.objects.keys()) {
-            b->setProperty(qPrintable(j), i.objects[j]);
-        }
+        mapping.apply(b, hda, i);
         addBuffer(ptr, b);
     }
 }
 
-void Lith::handleFirstReceivedLine(const Protocol::HData &hda) {
-    for (auto &i : hda.data) {
-        // buffer - lines - line - line_data
-        auto bufPtr = i.pointers.first();
-        auto linePtr = i.pointers.last();
+void Lith::handleBufferResync(const Protocol::HData &hda) {
+    PropertyMapping mapping(Buffer::staticMetaObject, hda);
+    auto nameField = hda.fieldIndex("name", Protocol::HData::Type::String);
+    bool rekeyed = false;
+    for (int i = 0; i < hda.count; i++) {
+        // buffer
+        auto ptr = hda.firstPointer(i);
+        auto buffer = getBuffer(ptr);
+        if (!buffer && nameField >= 0) {
+            // same name with a different pointer means the relay was restarted, the old pointers mean nothing now
+            auto &name = hda.string(i, nameField);
+            for (auto it = m_bufferMap.begin(); it != m_bufferMap.end(); ++it) {
+                if (!it.value() || it.value()->nameGet() != name || m_resyncBuffers.contains(it.key()))
+                    continue;
+                buffer = it.value();
+                m_bufferMap.erase(it);
+                // the lines are known by the old pointer, they have to go before it changes
+                buffer->clearLines();
+                buffer->ptrSet(ptr);
+                buffer->clearNicks();
+                m_bufferMap[ptr] = buffer;
+                if (!rekeyed)
+                    QMetaObject::invokeMethod(m_weechat, "forgetSyncedBuffers");
+                rekeyed = true;
+                if (buffer->isPrivateGet())
+                    QMetaObject::invokeMethod(m_weechat, "pinBuffer", Q_ARG(pointer_t, ptr));
+                break;
+            }
+        }
+        if (!buffer) {
+            buffer = new Buffer(this, ptr);
+            mapping.apply(buffer, hda, i);
+            addBuffer(ptr, buffer);
+        }
+        else {
+            mapping.apply(buffer, hda, i);
+        }
+        m_resyncBuffers.insert(ptr);
+    }
+}
+
+void Lith::handleLinesResync(LineBatch &&lines) {
+    if (!lines.continued)
+        m_resyncLinesBuffer.clear();
+    // the lines of each buffer come newest first, everything up to the first one we already have is new
+    for (auto &data : lines.items) {
+        auto bufPtr = data.buffer;
+        auto linePtr = data.ptr;
         auto buffer = getBuffer(bufPtr);
         if (!buffer) {
             qWarning() << "Line missing a parent:";
             continue;
         }
-        auto line = getLine(bufPtr, linePtr);
-        if (line)
+        if (buffer != m_resyncLinesBuffer) {
+            m_resyncLinesBuffer = buffer;
+            auto newest = buffer->lines()->count() > 0 ? buffer->lines()->get<BufferLine>(0) : nullptr;
+            m_resyncLinesNewest = newest ? newest->dateGet() : QDateTime();
+            m_resyncLinesInserted = 0;
+            m_resyncLinesDone = false;
+        }
+        if (m_resyncLinesDone)
+            continue;
+        if (getLine(bufPtr, linePtr) || (m_resyncLinesNewest.isValid() && data.date < m_resyncLinesNewest)) {
+            m_resyncLinesDone = true;
             continue;
-        line = new BufferLine(buffer);
-        for (auto j : i.objects.keys()) {
-            if (j != "buffer")
-                line->setProperty(qPrintable(j), i.objects[j]);
         }
+        auto line = new BufferLine(buffer, std::move(data));
+        buffer->insertLine(m_resyncLinesInserted++, line);
+        addLine(bufPtr, linePtr, line);
+        if (m_resyncLinesInserted >= Weechat::c_resyncLines) {
+            // more was said than we asked for, the old lines would leave a hole in the history
+            buffer->clearLines(m_resyncLinesInserted);
+            m_resyncLinesDone = true;
+        }
+    }
+}
+
+void Lith::handleFirstReceivedLine(LineBatch &&lines) {
+    for (auto &data : lines.items) {
+        auto bufPtr = data.buffer;
+        auto linePtr = data.ptr;
+        auto buffer = getBuffer(bufPtr);
+        if (!buffer) {
+            qWarning() << "Line missing a parent:";
+            continue;
+        }
+        if (getLine(bufPtr, linePtr))
+            continue;
+        auto line = new BufferLine(buffer, std::move(data));
         buffer->appendLine(line);
         addLine(bufPtr, linePtr, line);
     }
 }
 
-void Lith::handleHotlistInitialization(const Protocol::HData &hda) {
-    for (auto &i : hda.data) {
-        // hotlist
-        auto ptr = i.pointers.first();
-        auto bufPtr = i.objects["buffer"].value<pointer_t>();
+void Lith::handleHotlistInitialization(HotListBatch &&hotlist) {
+    for (auto &data : hotlist.items) {
         auto item = new HotListItem(this);
-        auto buffer = getBuffer(bufPtr);
+        auto buffer = getBuffer(data.buffer);
         if (buffer) {
             item->bufferSet(buffer);
         }
-        for (auto j : i.objects.keys()) {
-            if (j == "buffer")
-                continue;
-            item->setProperty(qPrintable(j), i.objects[j]);
-        }
-        addHotlist(ptr, item);
+        item->countSet(data.count);
+        addHotlist(data.ptr, item);
     }
 }
 
-void Lith::handleNicklistInitialization(const Protocol::HData &hda) {
-    for (auto &i : hda.data) {
-        // buffer - nicklist_item
-        auto bufPtr = i.pointers.first();
-        auto nickPtr = i.pointers.last();
-        auto buffer = getBuffer(bufPtr);
+void Lith::handleNicklistInitialization(NickBatch &&nicks) {
+    for (auto &data : nicks.items) {
+        auto buffer = getBuffer(data.buffer);
         if (!buffer) {
             qWarning() << "Nick missing a parent:";
             continue;
         }
-        auto nick = new Nick(buffer);
-        for (auto j : i.objects.keys()) {
-            nick->setProperty(qPrintable(j), i.objects[j]);
+        buffer->addNick(data.ptr, new Nick(buffer, data));
+    }
+}
+
+void Lith::handleHotlistResync(HotListBatch &&hotlist) {
+    for (auto &data : hotlist.items) {
+        auto buffer = getBuffer(data.buffer);
+        auto item = getHotlist(data.ptr);
+        if (!item) {
+            item = new HotListItem(this);
+            addHotlist(data.ptr, item);
+        }
+        item->bufferSet(buffer);
+        item->countSet(data.count);
+        m_resyncHotlist.insert(data.ptr);
+    }
+}
+
+void Lith::handleNicklistResync(NickBatch &&nicks) {
+    for (auto &data : nicks.items) {
+        auto buffer = getBuffer(data.buffer);
+        if (!buffer) {
+            qWarning() << "Nick missing a parent:";
+            continue;
         }
-        buffer->addNick(nickPtr, nick);
+        auto nick = buffer->getNick(data.ptr);
+        if (nick)
+            nick->update(data);
+        else
+            buffer->addNick(data.ptr, new Nick(buffer, data));
+        m_resyncNicks[data.buffer].insert(data.ptr);
     }
 }
 
-void Lith::handleFetchLines(const Protocol::HData &hda) {
-    for (auto &i : hda.data) {
-        // buffer - lines - line - line_data
-        auto bufPtr = i.pointers.first();
-        auto linePtr = i.pointers.last();
+void Lith::handleFetchLines(LineBatch &&lines) {
+    for (auto &data : lines.items) {
+        auto bufPtr = data.buffer;
+        auto linePtr = data.ptr;
         auto buffer = getBuffer(bufPtr);
         if (!buffer) {
             qWarning() << "Line missing a parent:";
             continue;
         }
-        auto line = getLine(bufPtr, linePtr);
-        if (line)
+        if (getLine(bufPtr, linePtr))
             continue;
-        line = new BufferLine(buffer);
-        for (auto j : i.objects.keys()) {
-            if (j != "buffer")
-                line->setProperty(qPrintable(j), i.objects[j]);
-        }
+        auto line = new BufferLine(buffer, std::move(data));
         buffer->appendLine(line);
         addLine(bufPtr, linePtr, line);
     }
 }
 
-void Lith::handleHotlist(const Protocol::HData &hda) {
-    for (auto &i : hda.data) {
-        // hotlist
-        auto hlPtr = i.pointers.first();
-        auto bufPtr = qvariant_cast<pointer_t>(i.objects["buffer"]);
-        auto hl = getHotlist(hlPtr);
-        auto buf = getBuffer(bufPtr);
+void Lith::handleFetchPage(pointer_t bufPtr, pointer_t cursor, bool historyStart, LineBatch &&lines) {
+    handleFetchLines(std::move(lines));
+    auto buffer = getBuffer(bufPtr);
+    if (buffer)
+        buffer->pageFetched(cursor, historyStart);
+}
+
+void Lith::handleHotlist(HotListBatch &&hotlist) {
+    for (auto &data : hotlist.items) {
+        auto hl = getHotlist(data.ptr);
+        auto buf = getBuffer(data.buffer);
         if (!buf) {
-            qWarning() << "Got a hotlist item" << QString("%1").arg(hlPtr, 16, 16, QChar('0')) <<  "for nonexistent buffer" << QString("%1").arg(bufPtr, 16, 16, QChar('0'));
+            qWarning() << "Got a hotlist item" << QString("%1").arg(data.ptr, 16, 16, QChar('0')) <<  "for nonexistent buffer" << QString("%1").arg(data.buffer, 16, 16, QChar('0'));
             continue;
         }
         if (!hl) {
             hl = new HotListItem(this);
             hl->bufferSet(buf);
         }
-        for (auto j : i.objects.keys()) {
-            if (j == "buffer")
-                continue;
-            hl->setProperty(qPrintable(j), i.objects[j]);
-        }
+        hl->countSet(data.count);
     }
 }
 
 void Lith::_buffer_opened(const Protocol::HData &hda) {
-    for (auto &i : hda.data) {
+    PropertyMapping mapping(Buffer::staticMetaObject, hda);
+    for (int i = 0; i < hda.count; i++) {
         // buffer
-        auto bufPtr = i.pointers.first();
+        auto bufPtr = hda.firstPointer(i);
         auto buffer = getBuffer(bufPtr);
         if (buffer)
             continue;
         buffer = new Buffer(this, bufPtr);
-        for (auto j : i.objects.keys()) {
-            buffer->setProperty(qPrintable(j), i.objects[j]);
-        }
+        mapping.apply(buffer, hda, i);
         addBuffer(bufPtr, buffer);
     }
 }
@@ -324,40 +482,45 @@ void Lith::_buffer_unhidden(const Protocol::HData &hda) {
 }
 
 void Lith::_buffer_renamed(const Protocol::HData &hda) {
-    for (auto &i : hda.data) {
+    for (int i = 0; i < hda.count; i++) {
         // buffer
-        auto bufPtr = i.pointers.first();
+        auto bufPtr = hda.firstPointer(i);
         auto buf = getBuffer(bufPtr);
         if (!buf)
             continue;
-        for (auto j : i.objects.keys()) {
-            if (j.endsWith("name")) {
-                buf->setProperty(qPrintable(j), i.objects[j]);
+        for (int j = 0; j < hda.fields.count(); j++) {
+            if (hda.fields[j].name.endsWith("name")) {
+                buf->setProperty(hda.fields[j].name.constData(), hda.value(i, j));
             }
         }
     }
 }
 
 void Lith::_buffer_title_changed(const Protocol::HData &hda) {
-    for (auto &i : hda.data) {
+    auto titleField = hda.fieldIndex("title", Protocol::HData::Type::String);
+    if (titleField < 0)
+        return;
+    for (int i = 0; i < hda.count; i++) {
         // buffer
-        auto bufPtr = i.pointers.first();
+        auto bufPtr = hda.firstPointer(i);
         auto buf = getBuffer(bufPtr);
         if (!buf)
             continue;
-        buf->titleSet(i.objects["title"].toString());
+        buf->titleSet(hda.string(i, titleField));
     }
 }
 
 void Lith::_buffer_localvar_added(const Protocol::HData &hda) {
-    for (auto &i : hda.data) {
+    auto localVariablesField = hda.fieldIndex("local_variables", Protocol::HData::Type::HashTable);
+    if (localVariablesField < 0)
+        return;
+    for (int i = 0; i < hda.count; i++) {
         // buffer
-        auto bufPtr = i.pointers.first();
+        auto bufPtr = hda.firstPointer(i);
         auto buf = getBuffer(bufPtr);
         if (!buf)
             continue;
-        auto strm = i.objects["local_variables"].value<StringMap>();
-        buf->local_variablesSet(strm);
+        buf->local_variablesSet(hda.hashTable(i, localVariablesField));
     }
 }
 
@@ -372,9 +535,9 @@ void Lith::_buffer_localvar_removed(const Protocol::HData &hda) {
 }
 
 void Lith::_buffer_closing(const Protocol::HData &hda) {
-    for (auto &i : hda.data) {
+    for (int i = 0; i < hda.count; i++) {
         // buffer
-        auto bufPtr = i.pointers.first();
+        auto bufPtr = hda.firstPointer(i);
         auto buffer = getBuffer(bufPtr);
         if (!buffer)
             continue;
@@ -389,27 +552,19 @@ void Lith::_buffer_cleared(const Protocol::HData &hda) {
     std::cerr << hda.toString().toStdString() << std::endl;
 }
 
-void Lith::_buffer_line_added(const Protocol::HData &hda) {
-    for (auto &i : hda.data) {
-        // line_data
-        auto linePtr = i.pointers.last();
-        // path doesn't contain the buffer, we need to retrieve it like this
-        auto bufPtr = qvariant_cast<pointer_t>(i.objects["buffer"]);
+void Lith::_buffer_line_added(LineBatch &&lines) {
+    for (auto &data : lines.items) {
+        auto bufPtr = data.buffer;
+        auto linePtr = data.ptr;
         auto buffer = getBuffer(bufPtr);
         if (!buffer) {
             qWarning() << "Line missing a parent:";
             continue;
         }
-        auto line = getLine(bufPtr, linePtr);
-        if (line) {
+        if (getLine(bufPtr, linePtr)) {
             continue;
         }
-        line = new BufferLine(buffer);
-        for (auto j : i.objects.keys()) {
-            if (j == "buffer")
-                continue;
-            line->setProperty(qPrintable(j), i.objects[j]);
-        }
+        auto line = new BufferLine(buffer, std::move(data));
         buffer->prependLine(line);
         addLine(bufPtr, linePtr, line);
         if (line->highlightGet() || (buffer->isPrivateGet() && line->isPrivMsgGet() && !line->isSelfMsgGet())) {
@@ -428,76 +583,54 @@ void Lith::_buffer_line_added(const Protocol::HData &hda) {
     }
 }
 
-void Lith::_nicklist(const Protocol::HData &hda) {
-    Buffer *previousBuffer = nullptr;
-    for (auto &i : hda.data) {
-        // buffer - nicklist_item
-        auto bufPtr = i.pointers.first();
-        auto nickPtr = i.pointers.last();
-        auto buffer = getBuffer(bufPtr);
+void Lith::_nicklist(NickBatch &&nicks) {
+    Buffer *previousBuffer = nicks.continued ? m_nicklistLastBuffer.data() : nullptr;
+    for (auto &data : nicks.items) {
+        auto buffer = getBuffer(data.buffer);
         if (!buffer)
             continue;
         if (buffer != previousBuffer)
             buffer->clearNicks();
         previousBuffer = buffer;
-        auto nick = new Nick(buffer);
-        for (auto j : i.objects.keys()) {
-            nick->setProperty(qPrintable(j), i.objects[j]);
-        }
-        buffer->addNick(nickPtr, nick);
+        buffer->addNick(data.ptr, new Nick(buffer, data));
     }
+    m_nicklistLastBuffer = previousBuffer;
 }
 
-void Lith::_nicklist_diff(const Protocol::HData &hda) {
-    for (auto &i : hda.data) {
-        // buffer - nicklist_item
-        auto bufPtr = i.pointers.first();
-        auto nickPtr = i.pointers.last();
-        auto buffer = getBuffer(bufPtr);
+void Lith::_nicklist_diff(NickBatch &&nicks) {
+    for (auto &data : nicks.items) {
+        auto buffer = getBuffer(data.buffer);
         if (!buffer)
             continue;
-        auto op = qvariant_cast<char>(i.objects["_diff"]);
-        switch (op) {
+        switch (data.diff) {
         case '+': {
-            auto nick = new Nick(buffer);
-            for (auto j : i.objects.keys()) {
-                if (j == "_diff")
-                    continue;
-                nick->setProperty(qPrintable(j), i.objects[j]);
-            }
-            buffer->addNick(nickPtr, nick);
+            buffer->addNick(data.ptr, new Nick(buffer, data));
             break;
         }
         case '-': {
-            buffer->removeNick(nickPtr);
+            buffer->removeNick(data.ptr);
             break;
         }
         case '^':
         case '*': {
-            auto nick = buffer->getNick(nickPtr);
+            auto nick = buffer->getNick(data.ptr);
             if (!nick)
                 break;
-            for (auto j : i.objects.keys()) {
-                if (j == "_diff")
-                    continue;
-                nick->setProperty(qPrintable(j), i.objects[j]);
-            }
+            nick->update(data);
             break;
         }
         default:
             break;
         }
-
     }
 }
 
-void Lith::_pong(const FormattedString &str) {
-    emit pongReceived(str.toLongLong());
-}
-
 void Lith::addBuffer(pointer_t ptr, Buffer *b) {
     m_bufferMap[ptr] = b;
     m_buffers->append(b);
+    // private messages keep notifying even when they weren't opened in a while
+    if (b->isPrivateGet())
+        QMetaObject::invokeMethod(m_weechat, "pinBuffer", Q_ARG(pointer_t, ptr));
     auto lastOpenBuffer = settingsGet()->lastOpenBufferGet();
     if (m_buffers->count() == 1 && lastOpenBuffer < 0)
         emit selectedBufferChanged();
@@ -513,6 +646,7 @@ void Lith::removeBuffer(pointer_t ptr) {
             selectedBufferIndexSet(selectedBufferIndex() - 1);
         m_bufferMap.remove(ptr);
         m_buffers->removeItem(buf);
+        QMetaObject::invokeMethod(m_weechat, "forgetBuffer", Q_ARG(pointer_t, ptr));
     }
 }
 
@@ -541,6 +675,11 @@ BufferLine *Lith::getLine(pointer_t bufPtr, pointer_t linePtr) {
     return nullptr;
 }
 
+void Lith::removeLine(pointer_t bufPtr, pointer_t linePtr) {
+    auto ptr = bufPtr << 32 | linePtr;
+    m_lineMap.remove(ptr);
+}
+
 void Lith::addHotlist(pointer_t ptr, HotListItem *hotlist) {
     if (m_hotList.contains(ptr)) {
         // TODO
@@ -22,11 +22,14 @@
 #include "protocol.h"
 #include "datamodel.h"
 #include "windowhelper.h"
+#include "util/connectionmetrics.h"
 #include "util/nicklistfilter.h"
 #include "util/messagelistfilter.h"
 
 #include <QSortFilterProxyModel>
 #include <QPointer>
+#include <QSet>
+#include <QHash>
 
 class Weechat;
 class ProxyBufferList;
@@ -48,9 +51,15 @@ public:
     Q_ENUMS(Status)
 private:
     PROPERTY(Status, status, UNCONFIGURED)
+    // commands are waiting for a slow connection to catch up
+    PROPERTY(bool, sendQueueCongested, false)
+    // how many times in a row reconnecting failed, and how long until the next attempt (ms) once it was scheduled
+    PROPERTY(int, reconnectAttempt, 0)
+    PROPERTY(int, reconnectDelay, 0)
     Q_PROPERTY(QString errorString READ errorStringGet WRITE errorStringSet NOTIFY errorStringChanged)
     PROPERTY_PTR(Settings, settings)
     PROPERTY_PTR(WindowHelper, windowHelper)
+    PROPERTY_PTR(ConnectionMetrics, metrics)
 
     Q_PROPERTY(bool hasPassphrase READ hasPassphrase NOTIFY hasPassphraseChanged)
     //Q_PROPERTY(Weechat* weechat READ weechat CONSTANT)
@@ -88,14 +97,13 @@ public:
 public slots:
     void resetData();
     void reconnect();
+    // a reconnection keeps the model, the replies to the resync requests are reconciled with it
+    void beginResync();
+    // drops what the relay didn't mention during the resync
+    void endResync();
 
     void handleBufferInitialization(const Protocol::HData &hda);
-    void handleFirstReceivedLine(const Protocol::HData &hda);
-    void handleHotlistInitialization(const Protocol::HData &hda);
-    void handleNicklistInitialization(const Protocol::HData &hda);
-
-    void handleFetchLines(const Protocol::HData &hda);
-    void handleHotlist(const Protocol::HData &hda);
+    void handleBufferResync(const Protocol::HData &hda);
 
     void _buffer_opened(const Protocol::HData &hda);
     void _buffer_type_changed(const Protocol::HData &hda);
@@ -111,10 +119,26 @@ public slots:
     void _buffer_localvar_removed(const Protocol::HData &hda);
     void _buffer_closing(const Protocol::HData &hda);
     void _buffer_cleared(const Protocol::HData &hda);
-    void _buffer_line_added(const Protocol::HData &hda);
-    void _nicklist(const Protocol::HData &hda);
-    void _nicklist_diff(const Protocol::HData &hda);
-    void _pong(const FormattedString &str);
+
+public:
+    // these receive records already built on the relay thread
+    void handleFirstReceivedLine(LineBatch &&lines);
+    void handleHotlistInitialization(HotListBatch &&hotlist);
+    void handleNicklistInitialization(NickBatch &&nicks);
+    void handleLinesResync(LineBatch &&lines);
+    void handleHotlistResync(HotListBatch &&hotlist);
+    void handleNicklistResync(NickBatch &&nicks);
+
+    void handleFetchLines(LineBatch &&lines);
+    void handleFetchPage(pointer_t bufPtr, pointer_t cursor, bool historyStart, LineBatch &&lines);
+    void handleHotlist(HotListBatch &&hotlist);
+
+    void _buffer_line_added(LineBatch &&lines);
+    void _nicklist(NickBatch &&nicks);
+    void _nicklist_diff(NickBatch &&nicks);
+
+    // forgets a line a buffer dropped, so it can be fetched again
+    void removeLine(pointer_t bufPtr, pointer_t linePtr);
 
 protected:
     void addBuffer(pointer_t ptr, Buffer *b);
@@ -130,7 +154,6 @@ signals:
     void selectedBufferChanged();
     void errorStringChanged();
 
-    void pongReceived(qint64 id);
 
 private:
     explicit Lith(QObject *parent = 0);
@@ -151,6 +174,18 @@ private:
     QMap<pointer_t, QPointer<Buffer>> m_bufferMap {};
     QMap<pointer_t, QPointer<BufferLine>> m_lineMap;
     QMap<pointer_t, QPointer<HotListItem>> m_hotList;
+    // buffer the last nicklist batch ended with, a nicklist split into more batches must not clear it again
+    QPointer<Buffer> m_nicklistLastBuffer;
+
+    // what the relay confirmed during the resync
+    QSet<pointer_t> m_resyncBuffers;
+    QSet<pointer_t> m_resyncHotlist;
+    QHash<pointer_t, QSet<pointer_t>> m_resyncNicks;
+    // the buffer the lines resync is at, new lines go in above the ones already there
+    QPointer<Buffer> m_resyncLinesBuffer;
+    QDateTime m_resyncLinesNewest;
+    int m_resyncLinesInserted { 0 };
+    bool m_resyncLinesDone { false };
 };
 
 class ProxyBufferList : public QSortFilterProxyModel {
@@ -98,6 +98,7 @@ int main(int argc, char *argv[])
     //qmlRegisterUncreatableType<LineModel>("lith", 1, 0, "LineModel", "");
     qmlRegisterUncreatableType<ClipboardProxy>("lith", 1, 0, "ClipboardProxy", "");
     qmlRegisterUncreatableType<Settings>("lith", 1, 0, "Settings", "");
+    qmlRegisterUncreatableType<ConnectionMetrics>("lith", 1, 0, "ConnectionMetrics", "");
     qmlRegisterUncreatableType<Uploader>("lith", 1, 0, "Uploader", "");
     qmlRegisterUncreatableType<WindowHelper>("lith", 1, 0, "WindowHelper", "");
     engine.rootContext()->setContextProperty("lith", Lith::instance());
@@ -19,139 +19,235 @@
 
 #include "lith.h"
 
-#include <QDataStream>
+#include <QtEndian>
+#include <QtAlgorithms>
 #include <QApplication>
 #include <QDateTime>
 #include <QAbstractEventDispatcher>
 #include <QStringLiteral>
 
+#include <array>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LITH_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+#define LITH_NEON
+#include <arm_neon.h>
+#endif
+
 namespace Protocol {
 
+bool Stream::readByte(quint8 &out) {
+    if (remaining() < 1)
+        return false;
+    out = static_cast<quint8>(*m_pos);
+    m_pos += 1;
+    return true;
+}
+
+bool Stream::readUInt32(quint32 &out) {
+    if (remaining() < 4)
+        return false;
+    out = qFromBigEndian<quint32>(m_pos);
+    m_pos += 4;
+    return true;
+}
+
+void Stream::seek(qsizetype position) {
+    m_pos = m_begin + qBound<qsizetype>(0, position, m_end - m_begin);
+}
+
+bool Stream::readBytes(qsizetype count, QByteArrayView &out) {
+    if (count < 0 || remaining() < count)
+        return false;
+    out = QByteArrayView(m_pos, count);
+    m_pos += count;
+    return true;
+}
+
+// Pointers, long integers and times are all sent as a single length byte followed by that many characters
+static bool readShortString(Stream &s, QByteArrayView &out) {
+    quint8 length = 0;
+    if (!s.readByte(length))
+        return false;
+    return s.readBytes(length, out);
+}
+
+static bool parseDecimal(QByteArrayView digits, qint64 &out) {
+    out = 0;
+    if (digits.isEmpty())
+        return false;
+    bool negative = false;
+    auto it = digits.begin();
+    if (*it == '-' || *it == '+') {
+        negative = *it == '-';
+        ++it;
+        if (it == digits.end())
+            return false;
+    }
+    for (; it != digits.end(); ++it) {
+        if (*it < '0' || *it > '9')
+            return false;
+        out = out * 10 + (*it - '0');
+    }
+    if (negative)
+        out = -out;
+    return true;
+}
+
+static bool parseHexadecimal(QByteArrayView digits, quint64 &out) {
+    out = 0;
+    if (digits.isEmpty())
+        return false;
+    for (auto c : digits) {
+        out <<= 4;
+        if (c >= '0' && c <= '9')
+            out |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            out |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            out |= c - 'A' + 10;
+        else
+            return false;
+    }
+    return true;
+}
+
+static bool isType(QByteArrayView type, const char *name) {
+    return type.size() == 3 && memcmp(type.data(), name, 3) == 0;
+}
+
 template <>
-Char parse(QDataStream &s, bool *ok) {
-    Char r;
-    s.readRawData(&r, 1);
+Char parse(Stream &s, bool *ok) {
+    quint8 r = 0;
+    bool parseOk = s.readByte(r);
     if (ok)
-        *ok = true;
-    return r;
+        *ok = parseOk;
+    return static_cast<Char>(r);
 }
 
 template <>
-Integer parse(QDataStream &s, bool *ok) {
-    Integer r;
-    s.setByteOrder(QDataStream::BigEndian);
-    s >> r;
+Integer parse(Stream &s, bool *ok) {
+    quint32 r = 0;
+    bool parseOk = s.readUInt32(r);
     if (ok)
-        *ok = true;
-    return r;
+        *ok = parseOk;
+    return static_cast<Integer>(r);
 }
 
 template <>
-LongInteger parse(QDataStream &s, bool *ok) {
-    LongInteger r;
-    quint8 length;
-    s >> length;
-    QByteArray buf((int) length + 1, 0);
-    s.readRawData(buf.data(), length);
-    r = buf.toLongLong();
+LongInteger parse(Stream &s, bool *ok) {
+    QByteArrayView digits;
+    LongInteger r = 0;
+    bool parseOk = readShortString(s, digits) && parseDecimal(digits, r);
     if (ok)
-        *ok = true;
+        *ok = parseOk;
     return r;
 }
 
 template <>
-String parse(QDataStream &s, bool canContainHtml, bool *ok) {
+String parse(Stream &s, bool canContainHtml, bool *ok) {
     String r;
-    uint32_t len;
-    r.clear();
-    s >> len;
-    if (len == uint32_t(-1))
-        r = String();
-    else if (len == 0)
-        r = "";
-    else if (len > 0) {
-        QByteArray buf(len + 1, 0);
-        s.readRawData(buf.data(), len);
-        r = convertColorsToHtml(buf, canContainHtml);
+    quint32 len = 0;
+    bool parseOk = s.readUInt32(len);
+    if (parseOk) {
+        if (len == quint32(-1)) {
+            r = String();
+        }
+        else if (len == 0) {
+            r = "";
+        }
+        else {
+            QByteArrayView buf;
+            parseOk = s.readBytes(len, buf);
+            if (parseOk)
+                r = convertColorsToHtml(buf, canContainHtml);
+        }
     }
     if (ok)
-        *ok = true;
+        *ok = parseOk;
     return r;
 }
 
 template<>
-String parse(QDataStream &s, bool *ok) {
+String parse(Stream &s, bool *ok) {
     return parse<String>(s, false, ok);
 }
 
 template <>
-Buffer parse(QDataStream &s, bool *ok) {
+Buffer parse(Stream &s, bool *ok) {
     Buffer r;
-    uint32_t len;
-    r.clear();
-    s >> len;
-    if (len == 0)
-        r = "";
-    if (len > 0) {
-        r = QByteArray(len, 0);
-        s.readRawData(r.data(), len);
+    quint32 len = 0;
+    bool parseOk = s.readUInt32(len);
+    if (parseOk) {
+        if (len == 0) {
+            r = "";
+        }
+        else if (len != quint32(-1)) {
+            QByteArrayView buf;
+            parseOk = s.readBytes(len, buf);
+            if (parseOk)
+                r = buf.toByteArray();
+        }
     }
     if (ok)
-        *ok = true;
+        *ok = parseOk;
     return r;
 }
 
 template <>
-Pointer parse(QDataStream &s, bool *ok) {
-    Pointer r;
-    quint8 length;;
-    s >> length;
-    QByteArray buf((int) length + 1, 0);
-    s.readRawData(buf.data(), length);
-    bool parseOk = false;
-    r = buf.toULongLong(&parseOk, 16);
+Pointer parse(Stream &s, bool *ok) {
+    QByteArrayView digits;
+    quint64 r = 0;
+    bool parseOk = readShortString(s, digits) && parseHexadecimal(digits, r);
     if (ok)
         *ok = parseOk;
     return r;
 }
 
 template <>
-Time parse(QDataStream &s, bool *ok) {
-    Time r;
-    quint8 length;
-    s >> length;
-    QByteArray buf((int) length + 1, 0);
-    s.readRawData(buf.data(), length);
-    r = buf;
+Time parse(Stream &s, bool *ok) {
+    QByteArrayView digits;
+    qint64 seconds = 0;
+    bool parseOk = readShortString(s, digits) && parseDecimal(digits, seconds);
     if (ok)
-        *ok = true;
-    return r;
+        *ok = parseOk;
+    return QDateTime::fromSecsSinceEpoch(seconds);
 }
 
 template <>
-HashTable parse(QDataStream &s, bool *ok) {
+HashTable parse(Stream &s, bool *ok) {
     HashTable r;
-    char keyType[4] = { 0 }, valueType[4] = { 0 };
-    s.readRawData(keyType, 3);
-    if (QString(keyType) != "str") {
+    QByteArrayView keyType, valueType;
+    if (!s.readBytes(3, keyType) || !isType(keyType, "str")) {
         qWarning() << "Hashtable currently supports only string keys";
         if (ok)
             *ok = false;
         return r;
     }
-    s.readRawData(valueType, 3);
-    if (QString(valueType) != "str") {
+    if (!s.readBytes(3, valueType) || !isType(valueType, "str")) {
         qWarning() << "Hashtable currently supports only string values";
         if (ok)
             *ok = false;
         return r;
     }
     quint32 count = 0;
-    s >> count;
-    r.clear();
+    if (!s.readUInt32(count)) {
+        if (ok)
+            *ok = false;
+        return r;
+    }
     for (quint32 i = 0; i < count; i++) {
-        auto key = parse<String>(s);
-        auto value = parse<String>(s);
+        bool keyOk = false, valueOk = false;
+        auto key = parse<String>(s, &keyOk);
+        auto value = parse<String>(s, &valueOk);
+        if (!keyOk || !valueOk) {
+            if (ok)
+                *ok = false;
+            return r;
+        }
         r.insert(key, value);
     }
     if (ok)
@@ -159,141 +255,186 @@ HashTable parse(QDataStream &s, bool *ok) {
     return r;
 }
 
-template <>
-HData parse(QDataStream &s, bool *outerOk) {
-    HData r;
-    bool innerOk = false;
-    String hpath = parse<String>(s, &innerOk);
-    if (!innerOk) {
-        if (outerOk)
-            *outerOk = false;
-        return r;
+// Raw strings of the protocol itself (hdata path, keys) don't need to go through the color decoder
+static bool readRawString(Stream &s, QByteArrayView &out) {
+    quint32 len = 0;
+    if (!s.readUInt32(len))
+        return false;
+    if (len == quint32(-1)) {
+        out = QByteArrayView();
+        return true;
     }
-    String keys = parse<String>(s, &innerOk);
-    if (!innerOk) {
-        if (outerOk)
-            *outerOk = false;
-        return r;
+    return s.readBytes(len, out);
+}
+
+static HData::Type typeFromName(QByteArrayView name) {
+    static const struct {
+        const char *name;
+        HData::Type type;
+    } c_types[] = {
+        { "chr", HData::Type::Char },
+        { "int", HData::Type::Integer },
+        { "lon", HData::Type::LongInteger },
+        { "str", HData::Type::String },
+        { "buf", HData::Type::Buffer },
+        { "ptr", HData::Type::Pointer },
+        { "tim", HData::Type::Time },
+        { "htb", HData::Type::HashTable },
+        { "arr", HData::Type::Array },
+    };
+    for (auto &i : c_types) {
+        if (isType(name, i.name))
+            return i.type;
     }
-    Integer count = parse<Integer>(s, &innerOk);
-    if (!innerOk) {
-        if (outerOk)
-            *outerOk = false;
-        return r;
+    return HData::Type::Unknown;
+}
+
+// keys look like "number:int,name:str,local_variables:htb"
+static QList<HData::Field> compileSchema(QByteArrayView keys) {
+    QList<HData::Field> fields;
+    qsizetype start = 0;
+    while (start < keys.size()) {
+        qsizetype comma = start;
+        while (comma < keys.size() && keys[comma] != ',')
+            comma++;
+        auto key = keys.sliced(start, comma - start);
+        qsizetype colon = 0;
+        while (colon < key.size() && key[colon] != ':')
+            colon++;
+
+        HData::Field field;
+        field.name = key.first(colon).toByteArray();
+        if (colon < key.size())
+            field.type = typeFromName(key.sliced(colon + 1));
+        field.canContainHtml = field.name == "message" || field.name == "title" || field.name == "prefix";
+        if (field.type == HData::Type::Unknown)
+            qCritical() << "!!! Unhandled type:" << key.toByteArray();
+        fields.append(field);
+
+        start = comma + 1;
     }
-    r.path = hpath.split("/");
-    r.keys = keys.split(",");
+    return fields;
+}
 
-    for (int i = 0; i < count; i++) {
-        HData::Item item;
-        for (int j = 0; j < r.path.count(); j++) {
-            Pointer ptr = parse<Pointer>(s, &innerOk);
-            if (!innerOk) {
-                if (outerOk)
-                    *outerOk = false;
-                return r;
-            }
-            item.pointers.append(ptr);
-        }
-        for (int j = 0; j < r.keys.count(); j++) {
-            auto name = r.keys[j].split(":").first();
-            auto type = r.keys[j].split(":").last();
-            if (type == "int") {
-                Integer i = parse<Integer>(s, &innerOk);
-                if (!innerOk) {
-                    if (outerOk)
-                        *outerOk = false;
-                    return r;
-                }
-                item.objects[name] = QVariant::fromValue(i);
-            }
-            else if (type == "lon") {
-                LongInteger l = parse<LongInteger>(s, &innerOk);
-                if (!innerOk) {
-                    if (outerOk)
-                        *outerOk = false;
-                    return r;
-                }
-                item.objects[name] = QVariant::fromValue(l);
-            }
-            else if (type == "str" || type == "buf") {
-                bool canContainHTML = false;
-                if (name == "message" || name == "title" || name == "prefix")
-                    canContainHTML = true;
-                String str = parse<String>(s, canContainHTML, &innerOk);
-                if (!innerOk) {
-                    if (outerOk)
-                        *outerOk = false;
-                    return r;
-                }
-                item.objects[name] = QVariant::fromValue(str);
-            }
-            else if (type == "arr") {
-                char fieldType[4] = { 0 };
-                s.readRawData(fieldType, 3);
-                if (strcmp(fieldType, "int") == 0) {
-                    ArrayInt a = parse<ArrayInt>(s, &innerOk);
-                    if (!innerOk) {
-                        if (outerOk)
-                            *outerOk = false;
-                        return r;
-                    }
-                    item.objects[name] = QVariant::fromValue(a);
-                }
-                else if (strcmp(fieldType, "str") == 0) {
-                    ArrayStr a = parse<ArrayStr>(s, &innerOk);
-                    if (!innerOk) {
-                        if (outerOk)
-                            *outerOk = false;
-                        return r;
-                    }
-                    item.objects[name] = QVariant::fromValue(a);
-                }
-                else {
-                    qCritical() << "Unhandled array item type:" << fieldType << "for field" << name;
-                }
-            }
-            else if (type == "tim") {
-                Time t = parse<Time>(s, &innerOk);
-                if (!innerOk) {
-                    if (outerOk)
-                        *outerOk = false;
-                    return r;
-                }
-                item.objects[name] = QVariant::fromValue(QDateTime::fromSecsSinceEpoch(t.toLocal8Bit().toULongLong(nullptr, 10)));
-            }
-            else if (type == "ptr") {
-                Pointer p = parse<Pointer>(s, &innerOk);
-                if (!innerOk) {
-                    if (outerOk)
-                        *outerOk = false;
-                    return r;
-                }
-                item.objects[name] = QVariant::fromValue(p);
-            }
-            else if (type == "chr") {
-                Char c = parse<Char>(s, &innerOk);
-                if (!innerOk) {
-                    if (outerOk)
-                        *outerOk = false;
-                    return r;
-                }
-                item.objects[name] = QVariant::fromValue(c);
+// Reads the hpath, keys and count of a hdata message and prepares the columns
+static bool parseHDataHeader(Stream &s, HData &r, Integer &count) {
+    bool ok = false;
+    QByteArrayView hpath, keys;
+    if (!readRawString(s, hpath) || !readRawString(s, keys))
+        return false;
+    count = parse<Integer>(s, &ok);
+    if (!ok)
+        return false;
+    r.path = QString::fromUtf8(hpath).split("/");
+    r.setFields(compileSchema(keys));
+    return true;
+}
+
+static void reserveHDataItems(HData &r, qsizetype reserved) {
+    auto &c = r.columns;
+    r.pointers.reserve(reserved * r.path.count());
+    for (auto &field : r.fields) {
+        switch (field.type) {
+        case HData::Type::Char: c.chars[field.column].reserve(reserved); break;
+        case HData::Type::Integer: c.integers[field.column].reserve(reserved); break;
+        case HData::Type::LongInteger: c.longIntegers[field.column].reserve(reserved); break;
+        case HData::Type::String:
+        case HData::Type::Buffer: c.strings[field.column].reserve(reserved); break;
+        case HData::Type::Pointer: c.pointers[field.column].reserve(reserved); break;
+        case HData::Type::Time: c.times[field.column].reserve(reserved); break;
+        default: break;
+        }
+    }
+}
+
+// Appends one item to the columns
+// When this fails, some of the columns can already contain the item, HData::truncate brings them back in line
+static bool parseHDataItem(Stream &s, HData &r) {
+    bool ok = false;
+    auto &c = r.columns;
+    for (int j = 0; j < r.path.count(); j++) {
+        Pointer ptr = parse<Pointer>(s, &ok);
+        if (!ok)
+            return false;
+        r.pointers.append(ptr);
+    }
+    for (auto &field : r.fields) {
+        switch (field.type) {
+        case HData::Type::Char:
+            c.chars[field.column].append(parse<Char>(s, &ok));
+            break;
+        case HData::Type::Integer:
+            c.integers[field.column].append(parse<Integer>(s, &ok));
+            break;
+        case HData::Type::LongInteger:
+            c.longIntegers[field.column].append(parse<LongInteger>(s, &ok));
+            break;
+        case HData::Type::String:
+        case HData::Type::Buffer:
+            c.strings[field.column].append(parse<String>(s, field.canContainHtml, &ok));
+            break;
+        case HData::Type::Pointer:
+            c.pointers[field.column].append(parse<Pointer>(s, &ok));
+            break;
+        case HData::Type::Time:
+            c.times[field.column].append(parse<Time>(s, &ok));
+            break;
+        case HData::Type::HashTable:
+            c.hashTables[field.column].append(parse<HashTable>(s, &ok));
+            break;
+        case HData::Type::Array: {
+            QByteArrayView fieldType;
+            ok = s.readBytes(3, fieldType);
+            if (!ok)
+                break;
+            if (isType(fieldType, "int")) {
+                field.elementType = HData::Type::Integer;
+                c.arrayInts[field.column].append(parse<ArrayInt>(s, &ok));
+                c.arrayStrs[field.column].append(ArrayStr());
             }
-            else if (type == "htb") {
-                HashTable htb = parse<HashTable>(s, &innerOk);
-                if (!innerOk) {
-                    if (outerOk)
-                        *outerOk = false;
-                    return r;
-                }
-                item.objects[name] = QVariant::fromValue(htb);
+            else if (isType(fieldType, "str")) {
+                field.elementType = HData::Type::String;
+                c.arrayStrs[field.column].append(parse<ArrayStr>(s, &ok));
+                c.arrayInts[field.column].append(ArrayInt());
             }
             else {
-                qCritical() << "!!! Unhandled type:" << type << "for field" << name;
+                qCritical() << "Unhandled array item type:" << fieldType.toByteArray() << "for field" << field.name;
+                ok = false;
             }
+            break;
+        }
+        case HData::Type::Unknown:
+            // there's no way to know how long the value is, the rest of the message can't be parsed
+            ok = false;
+            break;
+        }
+        if (!ok)
+            return false;
+    }
+    r.count++;
+    return true;
+}
+
+template <>
+HData parse(Stream &s, bool *outerOk) {
+    HData r;
+    Integer count = 0;
+    if (!parseHDataHeader(s, r, count)) {
+        if (outerOk)
+            *outerOk = false;
+        return r;
+    }
+    // don't trust the count too much, it's only a hint
+    if (count > 0)
+        reserveHDataItems(r, qMin<qsizetype>(count, s.remaining()));
+
+    for (int i = 0; i < count; i++) {
+        if (!parseHDataItem(s, r)) {
+            r.truncate(r.count);
+            if (outerOk)
+                *outerOk = false;
+            return r;
         }
-        r.data.append(item);
     }
     if (outerOk)
         *outerOk = true;
@@ -301,11 +442,15 @@ HData parse(QDataStream &s, bool *outerOk) {
 }
 
 template <>
-ArrayInt parse(QDataStream &s, bool *outerOk) {
+ArrayInt parse(Stream &s, bool *outerOk) {
     ArrayInt r;
-    uint32_t len;
-    s >> len;
-    for (uint32_t i = 0; i < len; i++) {
+    quint32 len = 0;
+    if (!s.readUInt32(len)) {
+        if (outerOk)
+            *outerOk = false;
+        return r;
+    }
+    for (quint32 i = 0; i < len; i++) {
         bool innerOk = false;
         Integer num = parse<Integer>(s, &innerOk);
         if (!innerOk) {
@@ -321,11 +466,15 @@ ArrayInt parse(QDataStream &s, bool *outerOk) {
 }
 
 template <>
-ArrayStr parse(QDataStream &s, bool *outerOk) {
+ArrayStr parse(Stream &s, bool *outerOk) {
     ArrayStr r;
-    uint32_t len;
-    s >> len;
-    for (uint32_t i = 0; i < len; i++) {
+    quint32 len = 0;
+    if (!s.readUInt32(len)) {
+        if (outerOk)
+            *outerOk = false;
+        return r;
+    }
+    for (quint32 i = 0; i < len; i++) {
         bool innerOk = false;
         String str = parse<String>(s, &innerOk);
         if (!innerOk) {
@@ -340,351 +489,621 @@ ArrayStr parse(QDataStream &s, bool *outerOk) {
     return r;
 }
 
-FormattedString convertColorsToHtml(const QByteArray &data, bool canContainHtml) {
-    FormattedString result;
-
-    FormattedString::Part::Color foregroundColor;
-    bool foreground = false;
-    FormattedString::Part::Color backgroundColor;
-    bool background = false;
-    bool bold = false;
-    bool reverse = false;
-    bool italic = false;
-    bool underline = false;
-    bool keep = false;
-
-    auto carryOver = [&result, &foregroundColor, &foreground, &backgroundColor, &background, &bold, &reverse, &italic, &underline, &keep]() {
-        auto &part = result.addPart();
-
-        if (foreground)
-            part.foreground = foregroundColor;
-        if (background)
-            part.background = backgroundColor;
-        if (bold)
-            part.bold = true;
-        // if (reverse) TODO
-        if (italic)
-            part.italic = true;
-        if (underline)
-            part.underline = true;
-        // if (keep) TODO
+namespace {
 
-    };
-    auto endColors = [&carryOver, &foreground, &background]() {
-        if (background) {
-            background = false;
+// Classes of bytes the decoder has to stop at, everything else is copied as it is
+enum ByteClass : quint8 {
+    PlainByte,
+    NullByte,
+    ColorByte,           // 0x19
+    SetAttributesByte,   // 0x1A
+    RemoveAttributesByte,// 0x1B
+    ResetByte            // 0x1C
+};
+
+// Meaning of individual characters within a color code sequence
+enum CodeFlag : quint16 {
+    Bold = 1 << 0,
+    Reverse = 1 << 1,
+    Italic = 1 << 2,
+    Underline = 1 << 3,
+    // can continue a sequence of set (0x1A) attributes
+    InSetSequence = 1 << 4,
+    // can continue a sequence of removed (0x1B) attributes
+    InRemoveSequence = 1 << 5,
+    // skipped before the digits of a foreground color
+    ForegroundPrefix = 1 << 6,
+    // skipped before the digits of a background color
+    BackgroundPrefix = 1 << 7,
+    AttributeMask = Bold | Reverse | Italic | Underline
+};
+
+constexpr std::array<quint8, 256> makeByteClasses() {
+    std::array<quint8, 256> table {};
+    table[0x00] = NullByte;
+    table[0x19] = ColorByte;
+    table[0x1A] = SetAttributesByte;
+    table[0x1B] = RemoveAttributesByte;
+    table[0x1C] = ResetByte;
+    return table;
+}
+
+constexpr std::array<quint16, 256> makeCodeFlags() {
+    std::array<quint16, 256> table {};
+    // weechat uses both raw bytes and printable characters for attributes
+    table[0x01] = table['*'] = Bold;
+    table[0x02] = table['!'] = Reverse;
+    table[0x03] = table['/'] = Italic;
+    table[0x04] = table['_'] = Underline;
+    const unsigned char attributes[] = { 0x01, 0x02, 0x03, 0x04, '*', '!', '/', '_', '|' };
+    for (auto c : attributes)
+        table[c] |= InSetSequence | InRemoveSequence;
+    table['@'] |= InSetSequence;
+    table[0x1A] |= InSetSequence;
+    table[0x1B] |= InRemoveSequence;
+    const unsigned char prefixes[] = { '@', '*', '!', '/', '_', '|' };
+    for (auto c : prefixes)
+        table[c] |= ForegroundPrefix | BackgroundPrefix;
+    table[','] |= BackgroundPrefix;
+    table['~'] |= BackgroundPrefix;
+    return table;
+}
+
+constexpr auto c_byteClasses = makeByteClasses();
+constexpr auto c_codeFlags = makeCodeFlags();
+
+// Finds the first byte that isn't plain text, 16 bytes at a time where the CPU allows it
+const char *findSpecialByte(const char *it, const char *end) {
+#if defined(LITH_SSE2)
+    const __m128i first = _mm_set1_epi8(0x19);
+    const __m128i range = _mm_set1_epi8(0x1C - 0x19);
+    const __m128i zero = _mm_setzero_si128();
+    while (end - it >= 16) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+        // bytes 0x19 to 0x1C end up between 0 and 3 after the subtraction
+        auto shifted = _mm_sub_epi8(chunk, first);
+        auto control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, range), shifted);
+        auto null = _mm_cmpeq_epi8(chunk, zero);
+        auto mask = _mm_movemask_epi8(_mm_or_si128(control, null));
+        if (mask)
+            return it + qCountTrailingZeroBits(static_cast<quint32>(mask));
+        it += 16;
+    }
+#elif defined(LITH_NEON)
+    const uint8x16_t first = vdupq_n_u8(0x19);
+    const uint8x16_t range = vdupq_n_u8(0x1C - 0x19);
+    const uint8x16_t zero = vdupq_n_u8(0);
+    while (end - it >= 16) {
+        auto chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(it));
+        auto control = vcleq_u8(vsubq_u8(chunk, first), range);
+        auto null = vceqq_u8(chunk, zero);
+        // the exact position is found by the scalar loop below
+        if (vmaxvq_u8(vorrq_u8(control, null)))
+            break;
+        it += 16;
+    }
+#endif
+    while (it < end && c_byteClasses[static_cast<quint8>(*it)] == PlainByte)
+        ++it;
+    return it;
+}
+
+// Decodes a run of UTF-8 straight into the UTF-16 buffer of a QString
+// Stray continuation bytes are dropped, broken sequences become U+FFFD
+void appendUtf8(QString &text, const char *begin, const char *end) {
+    auto bytes = reinterpret_cast<const uchar*>(begin);
+    auto bytesEnd = reinterpret_cast<const uchar*>(end);
+
+    // every byte that starts a character takes one UTF-16 unit, four byte sequences take two
+    qsizetype units = 0;
+    for (auto it = bytes; it < bytesEnd; ++it) {
+        if ((*it & 0b11000000) != 0b10000000)
+            units++;
+        if (*it >= 0b11110000)
+            units++;
+    }
+    if (units == 0)
+        return;
+
+    auto oldSize = text.size();
+    text.resize(oldSize + units);
+    auto out = text.data() + oldSize;
+
+    auto it = bytes;
+    while (it < bytesEnd) {
+        uchar lead = *it;
+        if (lead < 0x80) {
+            *out++ = QChar(static_cast<char16_t>(lead));
+            ++it;
+            continue;
+        }
+
+        int length = 0;
+        char32_t codePoint = 0;
+        char32_t minimum = 0;
+        if ((lead & 0b11100000) == 0b11000000) {
+            length = 2;
+            codePoint = lead & 0b00011111;
+            minimum = 0x80;
+        }
+        else if ((lead & 0b11110000) == 0b11100000) {
+            length = 3;
+            codePoint = lead & 0b00001111;
+            minimum = 0x800;
+        }
+        else if ((lead & 0b11111000) == 0b11110000) {
+            length = 4;
+            codePoint = lead & 0b00000111;
+            minimum = 0x10000;
         }
-        if (foreground) {
-            foreground = false;
+        else if ((lead & 0b11000000) == 0b10000000) {
+            ++it;
+            continue;
         }
+        else {
+            *out++ = QChar(QChar::ReplacementCharacter);
+            ++it;
+            continue;
+        }
+
+        int i = 1;
+        for (; i < length && it + i < bytesEnd && (it[i] & 0b11000000) == 0b10000000; i++)
+            codePoint = (codePoint << 6) | (it[i] & 0b00111111);
+
+        if (i != length || codePoint < minimum || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) {
+            *out++ = QChar(QChar::ReplacementCharacter);
+            it += i;
+        }
+        else if (QChar::requiresSurrogates(codePoint)) {
+            *out++ = QChar(QChar::highSurrogate(codePoint));
+            *out++ = QChar(QChar::lowSurrogate(codePoint));
+            it += length;
+        }
+        else {
+            *out++ = QChar(static_cast<char16_t>(codePoint));
+            it += length;
+        }
+    }
+    text.resize(out - text.constData());
+}
+
+class ColorDecoder {
+public:
+    ColorDecoder(QByteArrayView data)
+        : m_it(data.begin())
+        , m_end(data.end())
+    {}
+
+    FormattedString decode() {
+        while (m_it < m_end) {
+            auto plainEnd = findSpecialByte(m_it, m_end);
+            if (plainEnd != m_it) {
+                appendText(m_it, plainEnd);
+                m_it = plainEnd;
+                if (m_it >= m_end)
+                    break;
+            }
+            switch (c_byteClasses[static_cast<quint8>(*m_it)]) {
+            case ColorByte:
+                ++m_it;
+                color();
+                break;
+            case SetAttributesByte:
+                setAttributes();
+                break;
+            case RemoveAttributesByte:
+                removeAttributes();
+                break;
+            case ResetByte:
+                ++m_it;
+                resetColors();
+                resetAttributes();
+                break;
+            case NullByte:
+            default:
+                ++m_it;
+                break;
+            }
+        }
+        // always close the colors and attributes, the number of parts decides whether the string gets rendered as HTML
+        resetColors();
+        resetAttributes();
+
+        m_result.prune();
+        return m_result;
+    }
+
+private:
+    char peek() const {
+        return m_it < m_end ? *m_it : 0;
+    }
+    quint16 flags() const {
+        return c_codeFlags[static_cast<quint8>(peek())];
+    }
+
+    void appendText(const char *begin, const char *end) {
+        appendUtf8(m_result.lastPart().text, begin, end);
+    }
+
+    // Every change of formatting starts a new part
+    void carryOver() {
+        auto &part = m_result.addPart();
+        if (m_hasForeground)
+            part.foreground = m_foreground;
+        if (m_hasBackground)
+            part.background = m_background;
+        part.bold = m_attributes & Bold;
+        // reverse isn't supported yet
+        part.italic = m_attributes & Italic;
+        part.underline = m_attributes & Underline;
+    }
+
+    void resetColors() {
+        m_hasForeground = false;
+        m_hasBackground = false;
         carryOver();
-    };
-    auto endAttrs = [&carryOver, &bold, &reverse, &italic, &underline, &keep]() {
-       if (bold) {
-           bold = false;
-       }
-       if (reverse) {
-           reverse = false;
-           // TODO
-       }
-       if (italic) {
-           italic = false;
-       }
-       if (underline) {
-           underline = false;
-       }
-       if (keep) {
-           // TODO
-       }
-       carryOver();
-    };
-    auto loadAttr = [&carryOver, &bold, &reverse, &italic, &underline, &keep](QByteArray::const_iterator &it) {
-       while (true) {
-           switch(*it) {
-           case 0x01: // fallthrough // TODO what the fuck weechat
-           case '*':
-               if (bold)
-                   break;
-               bold = true;
-               carryOver();
-               break;
-           case 0x02: // fallthrough
-           case '!':
-               if (reverse)
-                   break;
-               reverse = true;
-               carryOver();
-               break;
-           case 0x03: // fallthrough
-           case '/':
-               if (italic)
-                   break;
-               italic = true;
-               carryOver();
-               break;
-           case 0x04: // fallthrough
-           case '_':
-               if (underline)
-                   break;
-               underline = true;
-               carryOver();
-               break;
-           case '|':
-               break;
-           case '@':
-               break;
-           case 0x1A:
-               break;
-           default:
-               --it;
-               return;
-           }
-           ++it;
-       }
-    };
+    }
 
-    auto clearAttr = [&carryOver, &bold, &reverse, &italic, &underline, &keep](QByteArray::const_iterator &it) {
-       while (true) {
-           switch(*it) {
-           case 0x01: // fallthrough // TODO what the fuck weechat
-           case '*':
-               if (bold) {
-                   bold = false;
-                   carryOver();
-               }
-               break;
-           case 0x02: // fallthrough
-           case '!':
-               if (reverse) {
-                   reverse = false;
-                   carryOver();
-               }
-               break;
-           case 0x03: // fallthrough
-           case '/':
-               if (italic) {
-                   italic = false;
-                   carryOver();
-               }
-               break;
-           case 0x04: // fallthrough
-           case '_':
-               if (underline) {
-                   underline = false;
-                   carryOver();
-               }
-               break;
-           case '|':
-               break;
-           case 0x1B:
-               break;
-           default:
-               --it;
-               return;
-           }
-           ++it;
-       }
-    };
-    auto loadStd = [&carryOver, &foreground, &foregroundColor](QByteArray::const_iterator &it) {
-       while (*it == '@' || *it == '*' || *it == '!' || *it == '/' || *it == '_' || *it == '|')
-           ++it;
-       int code = 0;
-       if (*it == 0x19 || *it == 'F')
-           it++;
-       for (int i = 0; i < 2; i++) {
-           code *= 10;
-           code += (*it) - '0';
-           ++it;
-       }
-       --it;
-       if (foreground) {
-           foreground = false;
-       }
-       if (code == 0) {
-           foreground = true;
-           foregroundColor.extended = false;
-           foregroundColor.index = ColorTheme::FOREGROUND;
-       }
-       else if (code > 0 && code < ColorTheme::_LAST_WEECHAT_COLOR) {
-           foreground = true;
-           foregroundColor.extended = false;
-           foregroundColor.index = code;
-       }
-       carryOver();
-    };
-    auto loadExt = [&carryOver, &foreground, &foregroundColor](QByteArray::const_iterator &it) {
-        while (*it == '@' || *it == '*' || *it == '!' || *it == '/' || *it == '_' || *it == '|')
-           ++it;
+    void resetAttributes() {
+        m_attributes = 0;
+        carryOver();
+    }
+
+    void setAttributes() {
+        while (flags() & InSetSequence) {
+            auto attribute = flags() & AttributeMask;
+            if (attribute && !(m_attributes & attribute)) {
+                m_attributes |= attribute;
+                carryOver();
+            }
+            ++m_it;
+        }
+    }
+
+    void removeAttributes() {
+        while (flags() & InRemoveSequence) {
+            auto attribute = flags() & AttributeMask;
+            if (attribute && (m_attributes & attribute)) {
+                m_attributes &= ~attribute;
+                carryOver();
+            }
+            ++m_it;
+        }
+    }
+
+    // Always consumes the full count of characters, returns -1 if they weren't all digits
+    int readNumber(int digits) {
         int code = 0;
-        for (int i = 0; i < 5; i++) {
-           code *= 10;
-           code += (*it) - '0';
-           ++it;
+        for (int i = 0; i < digits && m_it < m_end; i++, ++m_it) {
+            if (code < 0 || *m_it < '0' || *m_it > '9')
+                code = -1;
+            else
+                code = code * 10 + (*m_it - '0');
+        }
+        return code;
+    }
+
+    void foreground(bool extended) {
+        while (flags() & ForegroundPrefix)
+            ++m_it;
+        auto code = readNumber(extended ? 5 : 2);
+        m_hasForeground = false;
+        if (extended) {
+            if (code >= 0 && code < ColorTheme::ExtendedColorCount) {
+                m_hasForeground = true;
+                m_foreground = { code, true };
+            }
         }
-        --it;
-        if (foreground) {
-           foreground = false;
+        else if (code == 0) {
+            m_hasForeground = true;
+            m_foreground = { ColorTheme::FOREGROUND, false };
         }
-        if (code >= 0 && code < ColorTheme::ExtendedColorCount) {
-            foreground = true;
-            foregroundColor.extended = true;
-            foregroundColor.index = code;
+        else if (code > 0 && code < ColorTheme::_LAST_WEECHAT_COLOR) {
+            m_hasForeground = true;
+            m_foreground = { code, false };
         }
         carryOver();
+    }
+
+    void background(bool extended) {
+        while (flags() & BackgroundPrefix)
+            ++m_it;
+        auto code = readNumber(extended ? 5 : 2);
+        m_hasBackground = false;
+        if (extended) {
+            if (code >= 0 && code < ColorTheme::ExtendedColorCount) {
+                m_hasBackground = true;
+                m_background = { code, true };
+            }
+        }
+        else if (code == 0) {
+            m_hasBackground = true;
+            m_background = { ColorTheme::BACKGROUND, false };
+        }
+        else if (code > 0 && code < ColorTheme::_LAST_WEECHAT_COLOR) {
+            m_hasBackground = true;
+            m_background = { code, false };
+        }
+        carryOver();
+    }
+
+    // "F" or "*" followed by optional "@", attributes and the color itself
+    void attributedForeground() {
+        bool extended = peek() == '@';
+        if (extended)
+            ++m_it;
+        setAttributes();
+        foreground(extended);
+    }
+
+    void attributedBackground() {
+        bool extended = peek() == '@';
+        if (extended)
+            ++m_it;
+        setAttributes();
+        background(extended);
+    }
+
+    // Everything following 0x19
+    void color() {
+        switch (peek()) {
+        case 'F':
+            ++m_it;
+            attributedForeground();
+            break;
+        case 'B':
+            ++m_it;
+            background(peek() == '@');
+            break;
+        case '*':
+            ++m_it;
+            attributedForeground();
+            if (peek() == ',' || peek() == '~') {
+                ++m_it;
+                attributedBackground();
+            }
+            break;
+        case '@':
+            ++m_it;
+            foreground(true);
+            break;
+        case 0x1C:
+            ++m_it;
+            resetColors();
+            break;
+        default:
+            foreground(false);
+            break;
+        }
+    }
+
+    const char *m_it;
+    const char *m_end;
+
+    FormattedString m_result;
+    FormattedString::Part::Color m_foreground;
+    FormattedString::Part::Color m_background;
+    bool m_hasForeground { false };
+    bool m_hasBackground { false };
+    quint16 m_attributes { 0 };
+};
+
+} // namespace
+
+FormattedString convertColorsToHtml(QByteArrayView data, bool canContainHtml) {
+    Q_UNUSED(canContainHtml);
+    return ColorDecoder(data).decode();
+}
+
+void HData::setFields(const QList<Field> &newFields) {
+    fields = newFields;
+    columns = Columns();
+    for (auto &field : fields) {
+        switch (field.type) {
+        case Type::Char:
+            field.column = columns.chars.count();
+            columns.chars.append({});
+            break;
+        case Type::Integer:
+            field.column = columns.integers.count();
+            columns.integers.append({});
+            break;
+        case Type::LongInteger:
+            field.column = columns.longIntegers.count();
+            columns.longIntegers.append({});
+            break;
+        case Type::String:
+        case Type::Buffer:
+            field.column = columns.strings.count();
+            columns.strings.append({});
+            break;
+        case Type::Pointer:
+            field.column = columns.pointers.count();
+            columns.pointers.append({});
+            break;
+        case Type::Time:
+            field.column = columns.times.count();
+            columns.times.append({});
+            break;
+        case Type::HashTable:
+            field.column = columns.hashTables.count();
+            columns.hashTables.append({});
+            break;
+        case Type::Array:
+            field.column = columns.arrayInts.count();
+            columns.arrayInts.append({});
+            columns.arrayStrs.append({});
+            break;
+        case Type::Unknown:
+            break;
+        }
+    }
+}
+
+void HData::clearItems() {
+    // the batch that took the items may still share the columns, start over with empty ones
+    pointers = {};
+    setFields(QList<Field>(fields));
+    count = 0;
+}
+
+void HData::truncate(int newCount) {
+    auto resize = [newCount](auto &columnList) {
+        for (auto &column : columnList) {
+            if (column.count() > newCount)
+                column.resize(newCount);
+        }
     };
-    auto loadBgStd = [&carryOver, &background, &backgroundColor](QByteArray::const_iterator &it) {
-       while (*it == '@' || *it == '*' || *it == '!' || *it == '/' || *it == '_' || *it == '|' || *it == ',' || *it == '~')
-           ++it;
-       int code = 0;
-       for (int i = 0; i < 2; i++) {
-           code *= 10;
-           code += (*it) - '0';
-           ++it;
-       }
-       --it;
-       if (background) {
-           background = false;
-       }
-       if (code == 0) {
-           background = true;
-           backgroundColor.extended = false;
-           backgroundColor.index = ColorTheme::BACKGROUND;
-       }
-       else if (code >= 0 && code < ColorTheme::_LAST_WEECHAT_COLOR) {
-           background = true;
-           backgroundColor.extended = false;
-           backgroundColor.index = code;
-       }
-       carryOver();
-    };
-    auto loadBgExt = [&carryOver, &background, &backgroundColor](QByteArray::const_iterator &it) {
-       while (*it == '@' || *it == '*' || *it == '!' || *it == '/' || *it == '_' || *it == '|' || *it == ',' || *it == '~')
-           ++it;
-       int code = 0;
-       for (int i = 0; i < 5; i++) {
-           code *= 10;
-           code += (*it) - '0';
-           ++it;
-       }
-       --it;
-       if (background) {
-           background = false;
-       }
-       if (code >= 0 && code < ColorTheme::ExtendedColorCount) {
-           background = true;
-           backgroundColor.extended = true;
-           backgroundColor.index = code;
-       }
-       carryOver();
-    };
-    auto getChar = [](QByteArray::const_iterator &it) -> QString {
-       if ((unsigned char) *it < 0x80) {
-           return QString(*it);
-       }
-       else {
-           QByteArray buf;
-           if ((*it & 0b11111000) == 0b11110000) {
-               buf += *it++;
-               buf += *it++;
-               buf += *it++;
-               buf += *it;
-           }
-           else if ((*it & 0b11110000) == 0b11100000) {
-               buf += *it++;
-               buf += *it++;
-               buf += *it;
-           }
-           else if ((*it & 0b11100000) == 0b11000000) {
-               buf += *it++;
-               buf += *it;
-           }
-           else {
-               return QString(*it);
-           }
-           return QString(buf);
-       }
-    };
-    for (auto it = data.begin(); it != data.end(); ++it) {
-       if (*it == 0x19) {
-           ++it;
-           if (*it == 'F') {
-               ++it;
-               if (*it == '@') {
-                   ++it;
-                   loadAttr(it);
-                   loadExt(it);
-               }
-               else {
-                   loadAttr(it);
-                   loadStd(it);
-               }
-           }
-           else if (*it == 'B') {
-               ++it;
-               if (*it == '@')
-                   loadBgExt(it);
-               else
-                   loadBgStd(it);
-           }
-           else if (*it == '*') {
-               ++it;
-               if (*it == '@') {
-                   ++it;
-                   loadAttr(it);
-                   loadExt(it);
-               }
-               else {
-                   loadAttr(it);
-                   loadStd(it);
-               }
-               ++it;
-               if (*it == ',' || *it == '~') {
-                   ++it;
-                   if (*it == '@') {
-                       ++it;
-                       loadAttr(it);
-                       loadBgExt(it);
-                   }
-                   else {
-                       loadAttr(it);
-                       loadBgStd(it);
-                   }
-               }
-               else {
-                   --it;
-               }
-           }
-           else if (*it == '@') {
-               ++it;
-               loadExt(it);
-           }
-           else if (*it == 0x1C) {
-               endColors();
-           }
-           else {
-               loadStd(it);
-           }
-       }
-       else if (*it == 0x1C) {
-           endColors();
-           endAttrs();
-       }
-       else if (*it == 0x1A) {
-           loadAttr(it);
-       }
-       else if (*it == 0x1B) {
-           clearAttr(it);
-       }
-       else if (*it) {
-           result += getChar(it);
-       }
-    }
-    endColors();
-    endAttrs();
-
-    result.prune();
-
-    return result;
+    if (pointers.count() > newCount * path.count())
+        pointers.resize(newCount * path.count());
+    resize(columns.chars);
+    resize(columns.integers);
+    resize(columns.longIntegers);
+    resize(columns.strings);
+    resize(columns.pointers);
+    resize(columns.times);
+    resize(columns.hashTables);
+    resize(columns.arrayInts);
+    resize(columns.arrayStrs);
+    count = newCount;
+}
+
+int HData::fieldIndex(const char *name, Type type) const {
+    for (int i = 0; i < fields.count(); i++) {
+        if (fields[i].name == name) {
+            if (type != Type::Unknown && fields[i].type != type)
+                return -1;
+            return i;
+        }
+    }
+    return -1;
+}
+
+QVariant HData::value(int item, int field) const {
+    switch (fields[field].type) {
+    case Type::Char:
+        return QVariant::fromValue(character(item, field));
+    case Type::Integer:
+        return QVariant::fromValue(integer(item, field));
+    case Type::LongInteger:
+        return QVariant::fromValue(longInteger(item, field));
+    case Type::String:
+    case Type::Buffer:
+        return QVariant::fromValue(string(item, field));
+    case Type::Pointer:
+        return QVariant::fromValue(pointerValue(item, field));
+    case Type::Time:
+        return QVariant::fromValue(time(item, field));
+    case Type::HashTable:
+        return QVariant::fromValue(hashTable(item, field));
+    case Type::Array:
+        if (fields[field].elementType == Type::Integer)
+            return QVariant::fromValue(arrayInt(item, field));
+        return QVariant::fromValue(arrayStr(item, field));
+    case Type::Unknown:
+        break;
+    }
+    return {};
+}
+
+void MessageParser::append(QByteArrayView data) {
+    if (m_adopted) {
+        // appending to somebody else's message, what's left of it has to be copied after all
+        m_buffer = QByteArray(m_buffer.constData() + m_offset, m_buffer.size() - m_offset);
+        m_offset = 0;
+        m_adopted = false;
+    }
+    // drop what was already parsed before the buffer grows, only a partial item is left over in there
+    if (m_offset > 0) {
+        m_buffer.remove(0, m_offset);
+        m_offset = 0;
+    }
+    m_buffer.append(data);
+}
+
+void MessageParser::adopt(const QByteArray &data, qsizetype offset) {
+    Q_ASSERT(m_state == State::Header && m_buffer.isEmpty());
+    m_buffer = data;
+    m_offset = offset;
+    m_adopted = true;
+}
+
+bool MessageParser::parse(bool complete) {
+    Stream s(m_buffer);
+    s.seek(m_offset);
+
+    if (m_state == State::Header) {
+        QByteArrayView id, type;
+        if (!readRawString(s, id) || !s.readBytes(3, type))
+            return !complete;
+        // both keep their allocation from the previous message
+        m_id.resize(0);
+        m_id.append(id);
+        m_type.resize(0);
+        m_type.append(type);
+        m_offset = s.position();
+        m_isHData = isType(type, "hda");
+        m_state = m_isHData ? State::HDataHeader : State::Payload;
+    }
+
+    if (m_state == State::HDataHeader) {
+        Integer count = 0;
+        if (!parseHDataHeader(s, m_hdata, count))
+            return !complete;
+        m_offset = s.position();
+        m_itemsRemaining = qMax(count, 0);
+        // reserve at most one batch, most of the message isn't here yet anyway
+        reserveHDataItems(m_hdata, qMin(m_itemsRemaining, c_batchSize));
+        m_state = m_itemsRemaining > 0 ? State::HDataItems : State::Finished;
+    }
+
+    if (m_state == State::HDataItems) {
+        while (m_itemsRemaining > 0 && m_hdata.count < c_batchSize) {
+            if (!parseHDataItem(s, m_hdata)) {
+                // the rest of the item didn't arrive yet, it will be parsed again from the start with more data
+                m_hdata.truncate(m_hdata.count);
+                return !complete;
+            }
+            m_offset = s.position();
+            m_itemsRemaining--;
+        }
+        if (m_itemsRemaining == 0)
+            m_state = State::Finished;
+    }
+
+    return true;
+}
+
+void MessageParser::reset() {
+    // the buffers are reused for the next message unless an unusually large one made them grow
+    if (m_adopted || m_buffer.capacity() > c_maxRetainedBuffer)
+        m_buffer = QByteArray();
+    else
+        m_buffer.resize(0);
+    m_adopted = false;
+    m_offset = 0;
+    m_state = State::Header;
+    m_id.resize(0);
+    m_type.resize(0);
+    m_isHData = false;
+    m_hdata = HData();
+    m_itemsRemaining = 0;
+    m_itemsTaken = 0;
+}
+
+HData MessageParser::takeHData() {
+    HData batch = m_hdata;
+    batch.continued = m_itemsTaken > 0;
+    m_itemsTaken += batch.count;
+    m_hdata.clearItems();
+    reserveHDataItems(m_hdata, qMin(m_itemsRemaining, c_batchSize));
+    return batch;
+}
+
+Stream MessageParser::payload() const {
+    Stream s(m_buffer);
+    s.seek(m_offset);
+    return s;
 }
 
 QString HData::toString() const {
@@ -692,24 +1111,24 @@ QString HData::toString() const {
 
     ret += "HDATA\n";
     ret += "- PATH:\n";
-    for (auto i : path) {
+    for (auto &i : path) {
         ret += "\t" + i + "\n";
     }
     ret += "- KEYS:\n";
-    for (auto i : keys) {
-        ret += "\t" + i + "\n";
+    for (auto &i : fields) {
+        ret += "\t" + QString::fromUtf8(i.name) + "\n";
     }
     ret += "-VALUES:\n";
-    for (auto i : data) {
+    for (int i = 0; i < count; i++) {
         ret += "\t-PATH\n";
         ret += "\t\t";
-        for (auto j : i.pointers) {
-            ret += QString("%1").arg(j, 8, 16, QChar('0')) + " ";
+        for (int j = 0; j < path.count(); j++) {
+            ret += QString("%1").arg(pointer(i, j), 8, 16, QChar('0')) + " ";
         }
         ret += "\n";
         ret += "\t-OBJECTS\n";
-        for (auto j : i.objects.keys()) {
-            ret += QString("\t\t") + j + ": \"" + i.objects[j].toString() + "\"\n";
+        for (int j = 0; j < fields.count(); j++) {
+            ret += QString("\t\t") + QString::fromUtf8(fields[j].name) + ": \"" + value(i, j).toString() + "\"\n";
         }
         ret += "\n";
     }
@@ -19,47 +19,189 @@
 
 #include "common.h"
 
+#include <QByteArrayView>
+#include <QDateTime>
+
 namespace Protocol {
+    // Read-only cursor over a received (already decompressed) message
+    // Every read is checked against the end of the buffer and nothing is copied,
+    // views returned by readBytes point directly into the original data
+    class Stream {
+    public:
+        Stream(QByteArrayView data)
+            : m_begin(data.data())
+            , m_pos(data.data())
+            , m_end(data.data() + data.size())
+        {}
+
+        bool atEnd() const { return m_pos >= m_end; }
+        qsizetype position() const { return m_pos - m_begin; }
+        qsizetype remaining() const { return m_end - m_pos; }
+        void seek(qsizetype position);
+
+        bool readByte(quint8 &out);
+        bool readUInt32(quint32 &out);
+        bool readBytes(qsizetype count, QByteArrayView &out);
+
+    private:
+        const char *m_begin { nullptr };
+        const char *m_pos { nullptr };
+        const char *m_end { nullptr };
+    };
+
     using Char = char;
     using Integer = qint32;
     using LongInteger = qint64;
     using String = FormattedString;
     using Buffer = QByteArray;
     using Pointer = pointer_t;
-    using Time = QString;
+    using Time = QDateTime;
     using HashTable = StringMap;
+    using ArrayInt = QList<int>;
+    using ArrayStr = QStringList;
     struct HData {
-        struct Item {
-            QList<Pointer> pointers;
-            QMap<QString,QVariant> objects;
+        enum class Type : quint8 {
+            Unknown,
+            Char,
+            Integer,
+            LongInteger,
+            String,
+            Buffer,
+            Pointer,
+            Time,
+            HashTable,
+            Array
+        };
+        // One entry of the "keys" header, compiled once per message
+        struct Field {
+            QByteArray name;
+            Type type { Type::Unknown };
+            bool canContainHtml { false };
+            // element type of arrays, known once the first item has been parsed
+            Type elementType { Type::Unknown };
+            // index of the column in the container matching the type
+            int column { -1 };
+        };
+        // Values are stored in typed columns instead of a map per item
+        // Array fields have a column in both arrayInts and arrayStrs, only the one matching the received item type is filled
+        struct Columns {
+            QList<QList<Char>> chars;
+            QList<QList<Integer>> integers;
+            QList<QList<LongInteger>> longIntegers;
+            QList<QList<String>> strings;
+            QList<QList<Pointer>> pointers;
+            QList<QList<Time>> times;
+            QList<QList<HashTable>> hashTables;
+            QList<QList<ArrayInt>> arrayInts;
+            QList<QList<ArrayStr>> arrayStrs;
         };
 
-        QStringList keys;
         QStringList path;
-        QList<Item> data;
+        QList<Field> fields;
+        // path pointers of all items, path.count() of them per item
+        QList<Pointer> pointers;
+        Columns columns;
+        int count { 0 };
+        // set when a previous batch of the same message was already delivered
+        bool continued { false };
+
+        void setFields(const QList<Field> &fields);
+        // drops all items, keeps the path and fields
+        void clearItems();
+        // drops items past the first count ones, including an item that was parsed only partially
+        void truncate(int count);
+        // returns -1 if there's no such field or if its type doesn't match
+        int fieldIndex(const char *name, Type type = Type::Unknown) const;
+
+        Pointer pointer(int item, int level) const { return pointers[item * path.count() + level]; }
+        Pointer firstPointer(int item) const { return pointer(item, 0); }
+        Pointer lastPointer(int item) const { return pointer(item, path.count() - 1); }
+
+        Char character(int item, int field) const { return columns.chars[fields[field].column][item]; }
+        Integer integer(int item, int field) const { return columns.integers[fields[field].column][item]; }
+        LongInteger longInteger(int item, int field) const { return columns.longIntegers[fields[field].column][item]; }
+        const String &string(int item, int field) const { return columns.strings[fields[field].column][item]; }
+        Pointer pointerValue(int item, int field) const { return columns.pointers[fields[field].column][item]; }
+        const Time &time(int item, int field) const { return columns.times[fields[field].column][item]; }
+        const HashTable &hashTable(int item, int field) const { return columns.hashTables[fields[field].column][item]; }
+        const ArrayInt &arrayInt(int item, int field) const { return columns.arrayInts[fields[field].column][item]; }
+        const ArrayStr &arrayStr(int item, int field) const { return columns.arrayStrs[fields[field].column][item]; }
+        // boxed value, only meant for generic code paths like setting QObject properties
+        QVariant value(int item, int field) const;
 
         QString toString() const;
     };
-    using ArrayInt = QList<int>;
-    using ArrayStr = QStringList;
 
-    template <typename T> T parse(QDataStream &s, bool canContainHtml, bool *ok = nullptr);
-    template <typename T> T parse(QDataStream &s, bool *ok = nullptr);
-
-    template <> Char parse(QDataStream &s, bool *ok);
-    template <> Integer parse(QDataStream &s, bool *ok);
-    template <> LongInteger parse(QDataStream &s, bool *ok);
-    template <> String parse(QDataStream &s, bool canContainHTML, bool *ok);
-    template <> String parse(QDataStream &s, bool *ok);
-    template <> Buffer parse(QDataStream &s, bool *ok);
-    template <> Pointer parse(QDataStream &s, bool *ok);
-    template <> Time parse(QDataStream &s, bool *ok);
-    template <> HashTable parse(QDataStream &s, bool *ok);
-    template <> HData parse(QDataStream &s, bool *ok);
-    template <> ArrayInt parse(QDataStream &s, bool *ok);
-    template <> ArrayStr parse(QDataStream &s, bool *ok);
-
-    FormattedString convertColorsToHtml(const QByteArray &data, bool canContainHTML);
+    template <typename T> T parse(Stream &s, bool canContainHtml, bool *ok = nullptr);
+    template <typename T> T parse(Stream &s, bool *ok = nullptr);
+
+    template <> Char parse(Stream &s, bool *ok);
+    template <> Integer parse(Stream &s, bool *ok);
+    template <> LongInteger parse(Stream &s, bool *ok);
+    template <> String parse(Stream &s, bool canContainHTML, bool *ok);
+    template <> String parse(Stream &s, bool *ok);
+    template <> Buffer parse(Stream &s, bool *ok);
+    template <> Pointer parse(Stream &s, bool *ok);
+    template <> Time parse(Stream &s, bool *ok);
+    template <> HashTable parse(Stream &s, bool *ok);
+    template <> HData parse(Stream &s, bool *ok);
+    template <> ArrayInt parse(Stream &s, bool *ok);
+    template <> ArrayStr parse(Stream &s, bool *ok);
+
+    FormattedString convertColorsToHtml(QByteArrayView data, bool canContainHTML);
+
+    // Parses one message while its (decompressed) bytes are still arriving
+    // Items of hdata messages can be taken in batches as soon as they're complete so the whole message never has to be buffered
+    class MessageParser {
+    public:
+        static constexpr int c_batchSize { 1000 };
+        static constexpr qsizetype c_maxRetainedBuffer { 1024 * 1024 };
+
+        void append(QByteArrayView data);
+        // Takes a whole message that's already in memory without copying it, the first offset bytes are skipped
+        // Only for a parser that was just reset
+        void adopt(const QByteArray &data, qsizetype offset = 0);
+        // Parses as much as the data received so far allows, stops when a batch of items is ready
+        // complete means no more data will come for this message, anything still missing is an error then
+        // Returns false if the message is malformed
+        bool parse(bool complete);
+        void reset();
+
+        bool hasHeader() const { return m_state != State::Header; }
+        // raw bytes of the id, the request sequence number after a semicolon included
+        const QByteArray &id() const { return m_id; }
+        const QByteArray &type() const { return m_type; }
+        bool isHData() const { return m_isHData; }
+        bool atEnd() const { return m_offset >= m_buffer.size(); }
+
+        int itemsAvailable() const { return m_hdata.count; }
+        int itemsTaken() const { return m_itemsTaken; }
+        // moves the items parsed so far into a new batch
+        HData takeHData();
+        // the rest of a message that isn't hdata, only usable once the message is complete
+        Stream payload() const;
+
+    private:
+        enum class State {
+            Header,
+            HDataHeader,
+            HDataItems,
+            Payload,
+            Finished
+        } m_state { State::Header };
+
+        QByteArray m_buffer;
+        // m_buffer is shared with whoever handed the message over, it's not ours to reuse
+        bool m_adopted { false };
+        // everything before this was already parsed
+        qsizetype m_offset { 0 };
+        QByteArray m_id;
+        QByteArray m_type;
+        bool m_isHData { false };
+        HData m_hdata;
+        int m_itemsRemaining { 0 };
+        int m_itemsTaken { 0 };
+    };
 };
 
 Q_DECLARE_METATYPE(Protocol::HData);
@@ -77,6 +77,15 @@ class Settings : public QObject {
     SETTING(QString, passphrase)
     SETTING(bool, handshakeAuth, false)
     SETTING(bool, connectionCompression, true)
+    // preferred algorithms first, separated by colons like in the handshake
+    SETTING(QString, connectionCompressionOrder, "zstd:zlib")
+    // seconds, the reconnection attempts back off up to this
+    SETTING(int, reconnectMaxDelay, 30)
+    // reconnect or check the connection right away when the application comes back to the foreground
+    SETTING(bool, connectionWarmUp, true)
+    // lines and nicklist changes are only pushed for the recently opened buffers and private messages
+    // off by default, the lines of the other buffers then only show up once they're opened
+    SETTING(bool, selectiveSync, false)
 #ifndef Q_OS_WASM
     SETTING(bool, useWebsockets, false)
     SETTING(QString, websocketsEndpoint, "weechat")
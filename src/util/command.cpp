@@ -0,0 +1,85 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#include "command.h"
+#include "sockethelper.h"
+
+#include <QStringEncoder>
+
+#include <charconv>
+
+Command::Command(SocketHelper *socket, QByteArray &buffer)
+    : m_socket(socket)
+    , m_buffer(buffer)
+    , m_start(buffer.size())
+{
+}
+
+Command::~Command() {
+    m_buffer.append('\n');
+    m_socket->commandQueued(m_key, m_start, m_urgent, m_tag);
+}
+
+Command &Command::replaceable(QByteArrayView kind, quint64 id) {
+    m_key = kind.toByteArray();
+    m_key.append(reinterpret_cast<const char*>(&id), sizeof(id));
+    return *this;
+}
+
+Command &Command::urgent() {
+    m_urgent = true;
+    return *this;
+}
+
+Command &Command::tagged(qint64 tag) {
+    m_tag = tag;
+    return *this;
+}
+
+Command &Command::operator<<(QByteArrayView data) {
+    m_buffer.append(data);
+    return *this;
+}
+
+Command &Command::operator<<(QStringView data) {
+    // encoded right at the end of the buffer
+    QStringEncoder encoder(QStringEncoder::Utf8);
+    auto oldSize = m_buffer.size();
+    m_buffer.resize(oldSize + encoder.requiredSpace(data.size()));
+    auto end = encoder.appendToBuffer(m_buffer.data() + oldSize, data);
+    m_buffer.resize(end - m_buffer.constData());
+    return *this;
+}
+
+Command &Command::operator<<(char c) {
+    m_buffer.append(c);
+    return *this;
+}
+
+Command &Command::operator<<(qint64 value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    m_buffer.append(digits, result.ptr - digits);
+    return *this;
+}
+
+Command &Command::operator<<(Hex value) {
+    char digits[16];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value.value, 16);
+    m_buffer.append("0x", 2);
+    m_buffer.append(digits, result.ptr - digits);
+    return *this;
+}
@@ -0,0 +1,65 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QStringView>
+
+class SocketHelper;
+
+// Builds one relay command right in the outgoing buffer of SocketHelper, without any intermediate strings
+// The newline is added and the write is scheduled once it goes out of scope:
+//     m_connection->command() << "(" << id << ") hdata buffer:" << Command::Hex { ptr } << "/lines/last_line(-1)/data";
+class Command {
+public:
+    // pointers are written as 0x-prefixed hex
+    struct Hex {
+        quint64 value;
+    };
+
+    Command(SocketHelper *socket, QByteArray &buffer);
+    ~Command();
+    Command(const Command &) = delete;
+    Command &operator=(const Command &) = delete;
+
+    Command &operator<<(QByteArrayView data);
+    Command &operator<<(QStringView data);
+    Command &operator<<(char c);
+    Command &operator<<(qint64 value);
+    Command &operator<<(int value) { return *this << qint64(value); }
+    Command &operator<<(Hex value);
+
+    // a newer command with the same kind and id replaces this one if it hasn't been sent yet,
+    // meant for requests that are only repeated because their answer is still missing
+    Command &replaceable(QByteArrayView kind, quint64 id = 0);
+    // goes out ahead of the commands held back on a congested connection, for what the user is waiting on
+    Command &urgent();
+    // SocketHelper::commandsWritten reports the tag once the command is handed over to the socket, 0 means no tag
+    Command &tagged(qint64 tag);
+
+private:
+    SocketHelper *m_socket;
+    QByteArray &m_buffer;
+    qsizetype m_start;
+    QByteArray m_key;
+    bool m_urgent { false };
+    qint64 m_tag { 0 };
+};
+
+#endif // COMMAND_H
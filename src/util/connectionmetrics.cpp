@@ -0,0 +1,88 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#include "connectionmetrics.h"
+
+#include <QtMath>
+
+void Histogram::record(qint64 value) {
+    if (value < 0)
+        value = 0;
+    auto bucket = value == 0 ? 0 : 64 - qCountLeadingZeroBits(quint64(value));
+    m_buckets[qMin(bucket, c_buckets - 1)]++;
+    m_count++;
+    m_sum += value;
+    m_max = qMax(m_max, value);
+}
+
+void Histogram::reset() {
+    *this = Histogram();
+}
+
+double Histogram::average() const {
+    if (m_count == 0)
+        return 0.0;
+    return double(m_sum) / m_count;
+}
+
+qint64 Histogram::percentile(double fraction) const {
+    if (m_count == 0)
+        return 0;
+    auto target = qCeil(fraction * m_count);
+    qint64 seen = 0;
+    for (int i = 0; i < c_buckets; i++) {
+        seen += m_buckets[i];
+        if (seen >= target) {
+            qint64 upper = i == 0 ? 0 : (qint64(1) << i) - 1;
+            return qMin(upper, m_max);
+        }
+    }
+    return m_max;
+}
+
+ConnectionMetrics::Snapshot ConnectionMetrics::Snapshot::fromStats(const ConnectionStats &stats, const Snapshot &previous, qint64 elapsedMs) {
+    Snapshot s;
+    s.bytesReceived = stats.bytesReceived;
+    s.bytesDecompressed = stats.bytesDecompressed;
+    s.bytesSent = stats.bytesSent;
+    s.compressionRatio = stats.bytesReceived > 0 ? double(stats.bytesDecompressed) / stats.bytesReceived : 0.0;
+    s.frames = stats.frames;
+    // the counters start over with a new connection
+    auto newFrames = stats.frames >= previous.frames ? stats.frames - previous.frames : stats.frames;
+    s.framesPerSecond = elapsedMs > 0 ? newFrames * 1000.0 / elapsedMs : 0.0;
+    s.decompressTimeAverage = stats.decompressTime.average();
+    s.decompressTimeP95 = stats.decompressTime.percentile(0.95);
+    s.decompressTimeMax = stats.decompressTime.max();
+    s.parseTimeAverage = stats.parseTime.average();
+    s.parseTimeP95 = stats.parseTime.percentile(0.95);
+    s.parseTimeMax = stats.parseTime.max();
+    s.pingLatency = stats.lastPingLatency;
+    s.pingLatencyAverage = stats.pingLatency.average();
+    s.pingLatencyMax = stats.pingLatency.max();
+    s.connectTime = stats.connectTime;
+    s.bytesPerLine = stats.lines > 0 ? double(stats.lineBytes) / stats.lines : 0.0;
+    return s;
+}
+
+ConnectionMetrics::ConnectionMetrics(QObject *parent)
+    : QObject(parent)
+{
+}
+
+void ConnectionMetrics::update(const Snapshot &snapshot) {
+    m_snapshot = snapshot;
+    emit updated();
+}
@@ -0,0 +1,130 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CONNECTIONMETRICS_H
+#define CONNECTIONMETRICS_H
+
+#include <QObject>
+
+#include <array>
+
+// Distribution of durations (or any other non-negative values) in power of two buckets
+// Cheap enough to record every single message
+class Histogram {
+public:
+    void record(qint64 value);
+    void reset();
+
+    qint64 count() const { return m_count; }
+    qint64 max() const { return m_max; }
+    double average() const;
+    // upper bound of the bucket where the given fraction of the values ends
+    qint64 percentile(double fraction) const;
+
+private:
+    // bucket 0 holds zero, bucket i holds values in [2^(i-1), 2^i)
+    static constexpr int c_buckets { 40 };
+    std::array<qint64, c_buckets> m_buckets {};
+    qint64 m_count { 0 };
+    qint64 m_sum { 0 };
+    qint64 m_max { 0 };
+};
+
+// Raw counters of the current connection, updated on the network thread
+// Durations are in microseconds
+struct ConnectionStats {
+    qint64 bytesReceived { 0 };
+    qint64 bytesDecompressed { 0 };
+    qint64 bytesSent { 0 };
+    qint64 frames { 0 };
+    Histogram decompressTime;
+    Histogram parseTime;
+    Histogram pingLatency;
+    qint64 lastPingLatency { -1 };
+    // from the start of the connection attempt until the initialization was done
+    qint64 connectTime { -1 };
+    // messages carrying lines and the lines in them
+    qint64 lineBytes { 0 };
+    qint64 lines { 0 };
+};
+
+#define METRIC(type, name) \
+    private: \
+        Q_PROPERTY(type name READ name ## Get NOTIFY updated) \
+    public: \
+        type name ## Get () const { return m_snapshot.name; }
+
+// What the network thread measured, for the diagnostics page to show
+// Durations are in microseconds, the values are refreshed once a second
+class ConnectionMetrics : public QObject {
+    Q_OBJECT
+public:
+    struct Snapshot {
+        qint64 bytesReceived { 0 };
+        qint64 bytesDecompressed { 0 };
+        qint64 bytesSent { 0 };
+        double compressionRatio { 0.0 };
+        qint64 frames { 0 };
+        double framesPerSecond { 0.0 };
+        double decompressTimeAverage { 0.0 };
+        qint64 decompressTimeP95 { 0 };
+        qint64 decompressTimeMax { 0 };
+        double parseTimeAverage { 0.0 };
+        qint64 parseTimeP95 { 0 };
+        qint64 parseTimeMax { 0 };
+        qint64 pingLatency { -1 };
+        double pingLatencyAverage { 0.0 };
+        qint64 pingLatencyMax { 0 };
+        qint64 connectTime { -1 };
+        double bytesPerLine { 0.0 };
+
+        // frames per second are counted since the previous snapshot
+        static Snapshot fromStats(const ConnectionStats &stats, const Snapshot &previous, qint64 elapsedMs);
+    };
+
+    ConnectionMetrics(QObject *parent = nullptr);
+
+    METRIC(qint64, bytesReceived)
+    METRIC(qint64, bytesDecompressed)
+    METRIC(qint64, bytesSent)
+    METRIC(double, compressionRatio)
+    METRIC(qint64, frames)
+    METRIC(double, framesPerSecond)
+    METRIC(double, decompressTimeAverage)
+    METRIC(qint64, decompressTimeP95)
+    METRIC(qint64, decompressTimeMax)
+    METRIC(double, parseTimeAverage)
+    METRIC(qint64, parseTimeP95)
+    METRIC(qint64, parseTimeMax)
+    METRIC(qint64, pingLatency)
+    METRIC(double, pingLatencyAverage)
+    METRIC(qint64, pingLatencyMax)
+    METRIC(qint64, connectTime)
+    METRIC(double, bytesPerLine)
+
+public:
+    void update(const Snapshot &snapshot);
+
+signals:
+    void updated();
+
+private:
+    Snapshot m_snapshot;
+};
+
+#undef METRIC
+
+#endif // CONNECTIONMETRICS_H
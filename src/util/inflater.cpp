@@ -0,0 +1,90 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#include "inflater.h"
+
+#include <QtGlobal>
+
+Inflater::~Inflater() {
+    if (m_initialized)
+        inflateEnd(&m_stream);
+}
+
+bool Inflater::start() {
+    m_active = false;
+    if (!m_initialized) {
+        m_stream = {};
+        if (inflateInit(&m_stream) != Z_OK)
+            return false;
+        m_initialized = true;
+    }
+    // much cheaper than setting up the whole state again for each message
+    else if (inflateReset(&m_stream) != Z_OK) {
+        return false;
+    }
+    m_active = true;
+    m_ended = false;
+    return true;
+}
+
+bool Inflater::feed(QByteArrayView input, QByteArray &output) {
+    if (!m_active)
+        return false;
+
+    m_compressedBytes += input.size();
+    m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    m_stream.avail_in = static_cast<uInt>(input.size());
+    auto room = qBound(c_minRoom, input.size() * c_expectedRatio, c_maxRoom);
+    forever {
+        // the spare room at the end of output is inflated into, then output is cut down to what was produced
+        auto used = output.size();
+        output.resize(used + room);
+        m_stream.next_out = reinterpret_cast<Bytef*>(output.data() + used);
+        m_stream.avail_out = static_cast<uInt>(room);
+        auto ret = inflate(&m_stream, Z_NO_FLUSH);
+        auto produced = room - static_cast<qsizetype>(m_stream.avail_out);
+        output.resize(used + produced);
+        m_decompressedBytes += produced;
+        if (ret == Z_STREAM_END) {
+            m_ended = true;
+            return true;
+        }
+        // Z_BUF_ERROR only means there was nothing to do, more input is needed
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+            return false;
+        if (m_stream.avail_out != 0)
+            return true;
+        // it didn't fit, the next round gets more room
+        room = qMin(room * 2, c_maxRoom);
+    }
+}
+
+bool Inflater::finish() {
+    auto ended = !m_active || m_ended;
+    m_active = false;
+    return ended;
+}
+
+double Inflater::ratio() const {
+    if (m_compressedBytes == 0)
+        return 0.0;
+    return double(m_decompressedBytes) / double(m_compressedBytes);
+}
+
+void Inflater::resetCounters() {
+    m_compressedBytes = 0;
+    m_decompressedBytes = 0;
+}
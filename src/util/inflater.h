@@ -0,0 +1,67 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef INFLATER_H
+#define INFLATER_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+
+#include <zlib.h>
+
+// Streaming zlib decompression of compressed messages
+// The input can be fed in arbitrary pieces as it arrives from the network,
+// the output for each piece is available immediately
+// One instance is kept per connection, the zlib state is reused for every message
+class Inflater {
+public:
+    Inflater() = default;
+    ~Inflater();
+    Inflater(const Inflater &) = delete;
+    Inflater &operator=(const Inflater &) = delete;
+
+    // starts decompressing a new message, drops the state of the previous one
+    bool start();
+    // decompresses the next piece of the message straight onto the end of output, nothing is copied afterwards
+    // output isn't reused between pieces, it goes to the parser through a queued connection and would only get detached
+    bool feed(QByteArrayView input, QByteArray &output);
+    // returns false when the message ended before the compressed stream did
+    bool finish();
+
+    bool isActive() const { return m_active; }
+
+    // totals since the last resetCounters(), to see how much the compression actually saves
+    qint64 compressedBytes() const { return m_compressedBytes; }
+    qint64 decompressedBytes() const { return m_decompressedBytes; }
+    double ratio() const;
+    void resetCounters();
+
+private:
+    // the room made for the output in one go, the relay messages usually inflate to about four times their size
+    static constexpr qsizetype c_minRoom { 16 * 1024 };
+    static constexpr qsizetype c_maxRoom { 4 * 1024 * 1024 };
+    static constexpr qsizetype c_expectedRatio { 4 };
+
+    z_stream m_stream {};
+    bool m_initialized { false };
+    bool m_active { false };
+    bool m_ended { false };
+
+    qint64 m_compressedBytes { 0 };
+    qint64 m_decompressedBytes { 0 };
+};
+
+#endif // INFLATER_H
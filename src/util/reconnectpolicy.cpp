@@ -0,0 +1,34 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#include "reconnectpolicy.h"
+
+#include <QRandomGenerator>
+
+int ReconnectPolicy::nextDelay() {
+    auto attempt = m_attempts++;
+    // most disconnects are a blip, try again right away
+    if (attempt == 0)
+        return 0;
+    // doubling from the base, stopping before the shift could overflow
+    qint64 ceiling = qint64(c_baseDelay) << qMin(attempt - 1, 20);
+    ceiling = qMin<qint64>(ceiling, m_maxDelay);
+    return QRandomGenerator::global()->bounded(int(ceiling) + 1);
+}
+
+void ReconnectPolicy::reset() {
+    m_attempts = 0;
+}
@@ -0,0 +1,43 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RECONNECTPOLICY_H
+#define RECONNECTPOLICY_H
+
+#include <QtGlobal>
+
+// Decides how long to wait before the next reconnection attempt
+// The first retry is immediate, the following ones back off exponentially up to a cap,
+// with full jitter so clients that lost the connection at the same time don't come back all at once
+class ReconnectPolicy {
+public:
+    static constexpr int c_baseDelay { 500 };
+
+    // milliseconds to wait before the next attempt, counts the attempt
+    int nextDelay();
+    // the connection works again
+    void reset();
+
+    void setMaxDelay(int milliseconds) { m_maxDelay = qMax(c_baseDelay, milliseconds); }
+    int maxDelay() const { return m_maxDelay; }
+    int attempts() const { return m_attempts; }
+
+private:
+    int m_attempts { 0 };
+    int m_maxDelay { 30000 };
+};
+
+#endif // RECONNECTPOLICY_H
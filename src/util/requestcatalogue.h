@@ -0,0 +1,34 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef REQUESTCATALOGUE_H
+#define REQUESTCATALOGUE_H
+
+#include <QByteArray>
+
+// The hdata keys each request asks for, exactly the ones the data model reads
+// Without a key list the relay sends every field, most of them are never looked at
+namespace RequestCatalogue {
+    // read through the properties of Buffer
+    QByteArray bufferKeys();
+    // read by LineData::fromHData
+    QByteArray lineKeys();
+    // read by HotListData::fromHData
+    QByteArray hotlistKeys();
+}
+
+#endif // REQUESTCATALOGUE_H
@@ -0,0 +1,158 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "requestregistry.h"
+
+#include <QDebug>
+
+#include <cstring>
+#include <vector>
+
+RequestRegistry::RequestRegistry(QObject *parent)
+    : QObject(parent)
+{
+    m_clock.start();
+    m_deadlineTimer->setSingleShot(true);
+    connect(m_deadlineTimer, &QTimer::timeout, this, &RequestRegistry::onDeadline);
+}
+
+RequestRegistry::Request RequestRegistry::issue(QByteArrayView name, int timeout, const QByteArray &supersedes) {
+    if (!supersedes.isEmpty()) {
+        for (auto &i : m_pending) {
+            if (!i.second.cancelled && i.second.supersedes == supersedes) {
+                // kept until the reply or the deadline, a late reply must still be recognized
+                // the command may have been replaced before it went out, then the deadline is all that's left
+                i.second.cancelled = true;
+                finish(i.second, CANCELLED);
+                if (i.second.deadline == c_noDeadline)
+                    arm(i.second);
+            }
+        }
+    }
+
+    auto id = m_nextId++;
+    auto &pending = m_pending[id];
+    pending.name = name.toByteArray();
+    pending.supersedes = supersedes;
+    pending.timeout = timeout;
+    pending.promise.start();
+    auto future = pending.promise.future();
+    scheduleDeadline();
+    return { id, future };
+}
+
+void RequestRegistry::sent(Id id) {
+    auto it = m_pending.find(id);
+    if (it == m_pending.end() || it->second.deadline != c_noDeadline)
+        return;
+    arm(it->second);
+    scheduleDeadline();
+}
+
+void RequestRegistry::abandonAll() {
+    auto pending = std::move(m_pending);
+    m_pending.clear();
+    m_deadlineTimer->stop();
+    for (auto &i : pending) {
+        if (!i.second.cancelled)
+            finish(i.second, DISCONNECTED);
+    }
+}
+
+bool RequestRegistry::isPending(QByteArrayView messageId) const {
+    return m_pending.find(parseId(messageId)) != m_pending.end();
+}
+
+void RequestRegistry::receiving(QByteArrayView messageId) {
+    auto it = m_pending.find(parseId(messageId));
+    if (it == m_pending.end())
+        return;
+    it->second.deadline = c_noDeadline;
+    scheduleDeadline();
+}
+
+void RequestRegistry::collect(QByteArrayView messageId, Protocol::HData &&hda) {
+    auto it = m_pending.find(parseId(messageId));
+    if (it == m_pending.end() || it->second.cancelled)
+        return;
+    it->second.hdata.append(std::move(hda));
+}
+
+void RequestRegistry::replied(QByteArrayView messageId) {
+    auto it = m_pending.find(parseId(messageId));
+    if (it == m_pending.end())
+        return;
+    auto pending = std::move(it->second);
+    m_pending.erase(it);
+    if (!pending.cancelled)
+        finish(pending, REPLIED);
+    scheduleDeadline();
+}
+
+RequestRegistry::Id RequestRegistry::parseId(QByteArrayView messageId) {
+    auto separator = static_cast<const char*>(std::memchr(messageId.data(), ';', messageId.size()));
+    if (!separator)
+        return -1;
+    bool ok = false;
+    auto id = messageId.sliced(separator - messageId.data() + 1).toByteArray().toLongLong(&ok);
+    return ok ? id : -1;
+}
+
+void RequestRegistry::arm(Pending &pending) {
+    pending.deadline = m_clock.elapsed() + pending.timeout;
+}
+
+void RequestRegistry::finish(Pending &pending, Status status) {
+    Reply reply { status, {} };
+    if (status == REPLIED)
+        reply.hdata = std::move(pending.hdata);
+    pending.hdata.clear();
+    pending.promise.addResult(std::move(reply));
+    pending.promise.finish();
+}
+
+void RequestRegistry::onDeadline() {
+    // the continuations may issue new requests, finish the promises only after the map is consistent again
+    std::vector<std::pair<Id, Pending>> expired;
+    auto now = m_clock.elapsed();
+    for (auto it = m_pending.begin(); it != m_pending.end();) {
+        if (it->second.deadline > now) {
+            ++it;
+            continue;
+        }
+        expired.emplace_back(it->first, std::move(it->second));
+        it = m_pending.erase(it);
+    }
+    scheduleDeadline();
+    for (auto &i : expired) {
+        if (i.second.cancelled)
+            continue;
+        qWarning() << "No reply to" << i.second.name << i.first << "in time";
+        finish(i.second, TIMED_OUT);
+    }
+}
+
+void RequestRegistry::scheduleDeadline() {
+    qint64 earliest = c_noDeadline;
+    for (auto &i : m_pending)
+        earliest = qMin(earliest, i.second.deadline);
+    if (earliest == c_noDeadline) {
+        m_deadlineTimer->stop();
+        return;
+    }
+    m_deadlineTimer->start(int(qMax<qint64>(0, earliest - m_clock.elapsed())));
+}
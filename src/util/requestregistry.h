@@ -0,0 +1,102 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef REQUESTREGISTRY_H
+#define REQUESTREGISTRY_H
+
+#include "protocol.h"
+
+#include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QPromise>
+#include <QTimer>
+
+#include <limits>
+#include <map>
+
+// Keeps track of the requests waiting for a reply
+// Each one gets a numeric id sent as "name;id", its future finishes with the reply once it's all in, or without it
+// when the deadline passes, a newer request supersedes it or the connection is gone
+// The deadline only runs between the command leaving the socket and the first part of the reply arriving
+class RequestRegistry : public QObject {
+    Q_OBJECT
+public:
+    using Id = qint64;
+    enum Status {
+        REPLIED,
+        TIMED_OUT,
+        CANCELLED,
+        DISCONNECTED,
+    };
+    struct Reply {
+        Status status { REPLIED };
+        // the hdata parts as the parser handed them over, empty unless replied
+        QList<Protocol::HData> hdata;
+    };
+    struct Request {
+        Id id;
+        QFuture<Reply> future;
+    };
+
+    RequestRegistry(QObject *parent = nullptr);
+
+    // a pending request with the same non-empty key is cancelled, its reply will be dropped
+    Request issue(QByteArrayView name, int timeout, const QByteArray &supersedes = {});
+    // the command was written out, its deadline starts now
+    void sent(Id id);
+    // the connection the requests went out on is gone, no replies are coming
+    void abandonAll();
+
+    // the message id of a reply some request is still waiting for, even if it was superseded since
+    bool isPending(QByteArrayView messageId) const;
+    // the reply has started arriving, however long the rest takes it's not timing out anymore
+    void receiving(QByteArrayView messageId);
+    // a part of the reply, kept until the rest of it is in
+    void collect(QByteArrayView messageId, Protocol::HData &&hda);
+    // the whole reply is in
+    void replied(QByteArrayView messageId);
+
+    // the number after the semicolon, -1 for messages that aren't replies to a registered request
+    static Id parseId(QByteArrayView messageId);
+
+private:
+    struct Pending {
+        QByteArray name;
+        QByteArray supersedes;
+        int timeout { 0 };
+        // not running until the command is sent
+        qint64 deadline { c_noDeadline };
+        bool cancelled { false };
+        QList<Protocol::HData> hdata;
+        QPromise<Reply> promise;
+    };
+    static constexpr qint64 c_noDeadline { std::numeric_limits<qint64>::max() };
+
+    void arm(Pending &pending);
+    static void finish(Pending &pending, Status status);
+    void onDeadline();
+    void scheduleDeadline();
+
+    std::map<Id, Pending> m_pending;
+    Id m_nextId { 1 };
+    QElapsedTimer m_clock;
+    QTimer *m_deadlineTimer { new QTimer(this) };
+};
+
+#endif // REQUESTREGISTRY_H
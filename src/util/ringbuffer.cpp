@@ -0,0 +1,74 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#include "ringbuffer.h"
+
+#include <QIODevice>
+
+#include <cstring>
+
+RingBuffer::RingBuffer(qsizetype capacity)
+    : m_data(capacity, Qt::Uninitialized)
+{
+    Q_ASSERT(capacity > 0 && (capacity & (capacity - 1)) == 0);
+}
+
+qsizetype RingBuffer::fill(QIODevice *device) {
+    qsizetype total = 0;
+    // at most two rounds, the free space can wrap around the end
+    while (freeSpace() > 0) {
+        auto tail = (m_head + m_size) & (capacity() - 1);
+        auto contiguous = qMin(freeSpace(), capacity() - tail);
+        auto bytes = device->read(m_data.data() + tail, contiguous);
+        if (bytes <= 0)
+            break;
+        m_size += bytes;
+        total += bytes;
+        if (bytes < contiguous)
+            break;
+    }
+    return total;
+}
+
+QByteArrayView RingBuffer::front(qsizetype length) const {
+    auto contiguous = qMin(qMin(length, m_size), capacity() - m_head);
+    return QByteArrayView(m_data.constData() + m_head, contiguous);
+}
+
+void RingBuffer::peek(char *destination, qsizetype length) const {
+    Q_ASSERT(length <= m_size);
+    auto first = qMin(length, capacity() - m_head);
+    std::memcpy(destination, m_data.constData() + m_head, first);
+    if (first < length)
+        std::memcpy(destination + first, m_data.constData(), length - first);
+}
+
+void RingBuffer::skip(qsizetype length) {
+    Q_ASSERT(length <= m_size);
+    m_size -= length;
+    // keep writing from the start while empty, fewer wrapped reads that way
+    m_head = m_size == 0 ? 0 : (m_head + length) & (capacity() - 1);
+}
+
+void RingBuffer::read(char *destination, qsizetype length) {
+    peek(destination, length);
+    skip(length);
+}
+
+void RingBuffer::clear() {
+    m_head = 0;
+    m_size = 0;
+}
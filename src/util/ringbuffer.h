@@ -0,0 +1,54 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+
+class QIODevice;
+
+// Fixed size byte ring for data received from a socket
+// Data is read straight into the free space and consumed from the front, nothing is ever moved around
+class RingBuffer {
+public:
+    // capacity has to be a power of two
+    explicit RingBuffer(qsizetype capacity);
+
+    qsizetype size() const { return m_size; }
+    qsizetype capacity() const { return m_data.size(); }
+    qsizetype freeSpace() const { return capacity() - m_size; }
+    bool isEmpty() const { return m_size == 0; }
+
+    // reads as much as fits from the device, returns how much that was
+    qsizetype fill(QIODevice *device);
+
+    // the contiguous part of the data at the front, at most length bytes long
+    QByteArrayView front(qsizetype length) const;
+    // copies length bytes from the front without consuming them
+    void peek(char *destination, qsizetype length) const;
+    void skip(qsizetype length);
+    void read(char *destination, qsizetype length);
+    void clear();
+
+private:
+    QByteArray m_data;
+    qsizetype m_head { 0 };
+    qsizetype m_size { 0 };
+};
+
+#endif // RINGBUFFER_H
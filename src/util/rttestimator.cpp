@@ -0,0 +1,43 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#include "rttestimator.h"
+
+#include <QtMath>
+
+void RttEstimator::addSample(qint64 milliseconds) {
+    double sample = milliseconds;
+    if (!m_hasSamples) {
+        m_smoothed = sample;
+        m_variation = sample / 2.0;
+        m_hasSamples = true;
+        return;
+    }
+    m_variation = 0.75 * m_variation + 0.25 * qAbs(m_smoothed - sample);
+    m_smoothed = 0.875 * m_smoothed + 0.125 * sample;
+}
+
+void RttEstimator::reset() {
+    *this = RttEstimator();
+}
+
+int RttEstimator::deadTimeout() const {
+    if (!m_hasSamples)
+        return c_initialTimeout;
+    // twice the TCP retransmission timeout, a single slow reply on a mobile network shouldn't kill the connection
+    auto timeout = qRound64(2.0 * (m_smoothed + 4.0 * m_variation));
+    return int(qBound<qint64>(c_minTimeout, timeout, c_maxTimeout));
+}
@@ -0,0 +1,45 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RTTESTIMATOR_H
+#define RTTESTIMATOR_H
+
+#include <QtGlobal>
+
+// Smoothed round trip time of the ping/pong exchange, computed the way TCP does it (RFC 6298)
+// The connection is considered dead when a reply takes much longer than usual
+class RttEstimator {
+public:
+    static constexpr int c_initialTimeout { 10000 };
+    static constexpr int c_minTimeout { 3000 };
+    static constexpr int c_maxTimeout { 30000 };
+
+    void addSample(qint64 milliseconds);
+    void reset();
+
+    bool hasSamples() const { return m_hasSamples; }
+    qint64 smoothed() const { return qRound64(m_smoothed); }
+    qint64 variation() const { return qRound64(m_variation); }
+    // milliseconds to wait for a reply before giving up on the connection
+    int deadTimeout() const;
+
+private:
+    bool m_hasSamples { false };
+    double m_smoothed { 0.0 };
+    double m_variation { 0.0 };
+};
+
+#endif // RTTESTIMATOR_H
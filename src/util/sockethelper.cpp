@@ -1,12 +1,32 @@
 #include "sockethelper.h"
 #include "weechat.h"
 #include "lith.h"
+#include "tracefile.h"
 
-#include <QDataStream>
+#include <QElapsedTimer>
+#include <QHostInfo>
+#include <QtEndian>
+
+#if defined(Q_OS_LINUX)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#endif // Q_OS_LINUX
 
 SocketHelper::SocketHelper(Weechat *parent)
     : QObject(parent)
 {
+    auto tracePath = Trace::recordPath();
+    if (!tracePath.isEmpty()) {
+        // direct connections, the chunks are written out before anybody else gets to them
+        auto trace = new TraceWriter(tracePath, this);
+        connect(this, &SocketHelper::dataReceived, trace, &TraceWriter::writeData, Qt::DirectConnection);
+        connect(this, &SocketHelper::messageFinished, trace, &TraceWriter::writeMessageEnd, Qt::DirectConnection);
+        connect(this, &SocketHelper::messageReceived, trace, &TraceWriter::writeMessage, Qt::DirectConnection);
+    }
 }
 
 bool SocketHelper::isConnected() {
@@ -27,6 +47,11 @@ Weechat *SocketHelper::weechat()
 
 void SocketHelper::onError(QAbstractSocket::SocketError e) {
     qWarning() << "Error!" << e;
+#ifndef Q_OS_WASM
+    // the server may have moved, look it up again next time
+    if (m_tcpSocket && m_tcpSocket->state() != QAbstractSocket::ConnectedState)
+        m_addressCache.remove(m_hostname);
+#endif // Q_OS_WASM
 #ifndef Q_OS_WASM
     if (m_tcpSocket)
         emit errorOccurred(m_tcpSocket->errorString());
@@ -37,18 +62,57 @@ void SocketHelper::onError(QAbstractSocket::SocketError e) {
 
 void SocketHelper::onDisconnected() {
     qCritical() << "Disconnected";
+    if (compressedBytes() > 0)
+        qInfo() << "Received" << compressedBytes() << "compressed bytes, decompressed to" << decompressedBytes() << "( ratio" << double(decompressedBytes()) / compressedBytes() << ")";
 
     emit disconnected();
 }
 
 void SocketHelper::onConnected() {
     qCritical() << "Connected";
+#ifndef Q_OS_WASM
+    if (m_tcpSocket) {
+        configureKeepAlive(m_tcpSocket->socketDescriptor());
+        // whatever the name resolved to works, remember it
+        AddressCacheEntry entry;
+        entry.address = m_tcpSocket->peerAddress();
+        entry.resolved.start();
+        m_addressCache[m_hostname] = entry;
+    }
+    if (m_webSocket)
+        storeSessionTicket();
+#endif // Q_OS_WASM
     emit connected();
 }
 
+#ifndef Q_OS_WASM
+void SocketHelper::configureKeepAlive(qintptr descriptor) {
+#if defined(Q_OS_LINUX)
+    // the kernel defaults take over two hours to notice a connection that silently went away
+    if (descriptor < 0)
+        return;
+    int idle = c_keepAliveIdle;
+    int interval = c_keepAliveInterval;
+    int count = c_keepAliveCount;
+    unsigned int userTimeout = c_userTimeout;
+    if (setsockopt(descriptor, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) != 0 ||
+        setsockopt(descriptor, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) != 0 ||
+        setsockopt(descriptor, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) != 0 ||
+        // unacknowledged data is given up on after this long too
+        setsockopt(descriptor, IPPROTO_TCP, TCP_USER_TIMEOUT, &userTimeout, sizeof(userTimeout)) != 0) {
+        qWarning() << "Failed to configure TCP keepalive:" << strerror(errno);
+    }
+#else
+    Q_UNUSED(descriptor)
+#endif // Q_OS_LINUX
+}
+#endif // Q_OS_WASM
+
 void SocketHelper::connectToWebsocket(const QString &hostname, const QString &endpoint, int port, bool encrypted) {
     reset();
     qCritical() << "Trying to connect to:" << QString("%1://%2:%3/%4").arg(encrypted ? "wss" : "ws").arg(hostname).arg(port).arg(endpoint);
+    // QtWebSockets doesn't implement any extensions, permessage-deflate included
+    // compression is negotiated in the relay handshake instead, just like over plain TCP
     m_webSocket = new QWebSocket("weechat", QWebSocketProtocol::VersionLatest, this);
 
     connect(m_webSocket, &QWebSocket::connected, this, &SocketHelper::onConnected);
@@ -56,6 +120,7 @@ void SocketHelper::connectToWebsocket(const QString &hostname, const QString &en
     connect(m_webSocket, QOverload<QAbstractSocket::SocketError>::of(&QWebSocket::error), this, &SocketHelper::onError);
 
     connect(m_webSocket, &QWebSocket::binaryMessageReceived, this, &SocketHelper::onBinaryMessageReceived);
+    connect(m_webSocket, &QWebSocket::bytesWritten, this, &SocketHelper::onBytesWritten);
 
     QList<QSslError> expectedSslErrors;
     if (weechat()->lith()->settingsGet()->allowSelfSignedCertificatesGet()) {
@@ -63,6 +128,12 @@ void SocketHelper::connectToWebsocket(const QString &hostname, const QString &en
         expectedSslErrors.append(QSslError(QSslError::SelfSignedCertificateInChain));
     }
     m_webSocket->ignoreSslErrors(expectedSslErrors);
+#ifndef Q_OS_WASM
+    m_hostname = hostname;
+    m_port = port;
+    if (encrypted)
+        m_webSocket->setSslConfiguration(resumableSslConfiguration(m_webSocket->sslConfiguration()));
+#endif // Q_OS_WASM
 
     m_webSocket->open(QString("%1://%2:%3/%4").arg(encrypted ? "wss" : "ws").arg(hostname).arg(port).arg(endpoint));
 }
@@ -72,6 +143,8 @@ void SocketHelper::connectToTcpSocket(const QString &hostname, int port, bool en
     reset();
     m_tcpSocket = new QSslSocket(this);
     m_tcpSocket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+    // the commands are already coalesced into one write per event loop turn, Nagle would only delay them
+    m_tcpSocket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
 
     QList<QSslError> expectedSslErrors;
     if (weechat()->lith()->settingsGet()->allowSelfSignedCertificatesGet()) {
@@ -87,83 +160,334 @@ void SocketHelper::connectToTcpSocket(const QString &hostname, int port, bool en
 #endif
     connect(m_tcpSocket, static_cast<void(QSslSocket::*)(const QList<QSslError> &)>(&QSslSocket::sslErrors), this, &SocketHelper::onSslErrors, Qt::QueuedConnection);
     connect(m_tcpSocket, &QSslSocket::readyRead, this, &SocketHelper::onReadyRead, Qt::QueuedConnection);
+    connect(m_tcpSocket, &QSslSocket::bytesWritten, this, &SocketHelper::onBytesWritten, Qt::QueuedConnection);
     connect(m_tcpSocket, &QSslSocket::connected, this, &SocketHelper::onConnected, Qt::QueuedConnection);
     connect(m_tcpSocket, &QSslSocket::disconnected, this, &SocketHelper::onDisconnected, Qt::QueuedConnection);
 
+    connect(m_tcpSocket, &QSslSocket::encrypted, this, &SocketHelper::storeSessionTicket, Qt::QueuedConnection);
+    // TLS 1.3 servers send the tickets only after the handshake
+    connect(m_tcpSocket, &QSslSocket::newSessionTicketReceived, this, &SocketHelper::storeSessionTicket, Qt::QueuedConnection);
+
+    m_hostname = hostname;
+    m_port = port;
     if (encrypted)
-        m_tcpSocket->connectToHostEncrypted(hostname, port);
-    else
-        m_tcpSocket->connectToHost(hostname, port);
+        m_tcpSocket->setSslConfiguration(resumableSslConfiguration(m_tcpSocket->sslConfiguration()));
+
+    // a known address saves a DNS round trip, the certificate is still checked against the hostname
+    auto address = cachedAddress(hostname);
+    if (!address.isNull()) {
+        if (encrypted)
+            m_tcpSocket->connectToHostEncrypted(address.toString(), port, hostname);
+        else
+            m_tcpSocket->connectToHost(address, port);
+    }
+    else {
+        if (encrypted)
+            m_tcpSocket->connectToHostEncrypted(hostname, port);
+        else
+            m_tcpSocket->connectToHost(hostname, port);
+    }
+}
+
+QSslConfiguration SocketHelper::resumableSslConfiguration(QSslConfiguration configuration) const {
+    configuration.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    auto ticket = m_sessionTickets.value(sessionKey());
+    if (!ticket.isEmpty())
+        configuration.setSessionTicket(ticket);
+    return configuration;
+}
+
+QString SocketHelper::sessionKey() const {
+    return QString("%1:%2").arg(m_hostname).arg(m_port);
+}
+
+void SocketHelper::storeSessionTicket() {
+    QByteArray ticket;
+    if (m_tcpSocket)
+        ticket = m_tcpSocket->sslConfiguration().sessionTicket();
+    else if (m_webSocket)
+        ticket = m_webSocket->sslConfiguration().sessionTicket();
+    if (!ticket.isEmpty())
+        m_sessionTickets[sessionKey()] = ticket;
+}
+
+QHostAddress SocketHelper::cachedAddress(const QString &hostname) const {
+    auto it = m_addressCache.constFind(hostname);
+    if (it == m_addressCache.constEnd() || it->resolved.hasExpired(c_addressCacheTtl))
+        return QHostAddress();
+    return it->address;
+}
+
+void SocketHelper::warmUp(const QString &hostname) {
+    if (hostname.isEmpty() || !cachedAddress(hostname).isNull())
+        return;
+    // the next connection attempt won't have to wait for the lookup
+    QHostInfo::lookupHost(hostname, this, [this, hostname](const QHostInfo &info) {
+        if (info.error() != QHostInfo::NoError || info.addresses().isEmpty())
+            return;
+        AddressCacheEntry entry;
+        entry.address = info.addresses().first();
+        entry.resolved.start();
+        m_addressCache[hostname] = entry;
+    });
 }
 
 #endif // Q_OS_WASM
 
-qint64 SocketHelper::write(const char *data) {
-     return write(QByteArray(data));
+Command SocketHelper::command() {
+    return Command(this, m_outgoing);
 }
 
-qint64 SocketHelper::write(const QString &data) {
-    return write(data.toUtf8());
+void SocketHelper::commandQueued(const QByteArray &key, qsizetype start, bool urgent, qint64 tag) {
+    // only while congested, otherwise the order the commands were issued in is kept
+    if (urgent && m_congested) {
+        m_urgent.append(m_outgoing.constData() + start, m_outgoing.size() - start);
+        m_outgoing.truncate(start);
+        if (tag)
+            m_urgentTags.append(tag);
+        scheduleFlush();
+        return;
+    }
+    if (tag)
+        m_outgoingTags.append(tag);
+    if (!key.isEmpty()) {
+        auto size = m_outgoing.size() - start;
+        for (auto it = m_replaceable.begin(); it != m_replaceable.end(); ++it) {
+            if (it->key != key)
+                continue;
+            // the older one is still here, the new one makes it pointless
+            auto removed = *it;
+            m_outgoing.remove(removed.offset, removed.size);
+            if (removed.tag)
+                m_outgoingTags.removeOne(removed.tag);
+            m_replaceable.erase(it);
+            for (auto &i : m_replaceable) {
+                if (i.offset > removed.offset)
+                    i.offset -= removed.size;
+            }
+            start -= removed.size;
+            break;
+        }
+        m_replaceable.append({ key, start, size, tag });
+    }
+    scheduleFlush();
+}
+
+void SocketHelper::scheduleFlush() {
+    if (m_flushScheduled)
+        return;
+    // everything queued until the event loop gets back to us goes out in a single write
+    m_flushScheduled = true;
+    QMetaObject::invokeMethod(this, &SocketHelper::flush, Qt::QueuedConnection);
+}
+
+qint64 SocketHelper::bytesToWrite() const {
+#ifndef Q_OS_WASM
+    if (m_tcpSocket)
+        return m_tcpSocket->bytesToWrite();
+#endif // Q_OS_WASM
+    return m_webSocketBytesToWrite;
+}
+
+void SocketHelper::setCongested(bool congested) {
+    if (m_congested == congested)
+        return;
+    m_congested = congested;
+    if (congested)
+        qWarning() << "The connection is congested, holding back" << m_outgoing.size() << "bytes of commands";
+    else
+        qWarning() << "The connection caught up";
+    emit congestionChanged(congested);
+}
+
+void SocketHelper::flush() {
+    m_flushScheduled = false;
+    // a few bytes of input or a ping don't make the congestion any worse, they don't wait behind the held back requests
+    if (!m_urgent.isEmpty()) {
+        write(m_urgent);
+        m_urgent.resize(0);
+        if (!m_urgentTags.isEmpty())
+            emit commandsWritten(std::exchange(m_urgentTags, {}));
+    }
+    if (m_outgoing.isEmpty())
+        return;
+    // the socket has enough to do, keep the rest here where it can still be replaced, onBytesWritten comes back for it
+    if (bytesToWrite() >= c_highWaterMark) {
+        setCongested(true);
+        return;
+    }
+
+    write(m_outgoing);
+    // the sockets have their own copy now, the buffer is kept for the next round
+    if (m_outgoing.capacity() > c_maxRetainedOutgoing)
+        m_outgoing = QByteArray();
+    else
+        m_outgoing.resize(0);
+    m_replaceable.clear();
+    if (!m_outgoingTags.isEmpty())
+        emit commandsWritten(std::exchange(m_outgoingTags, {}));
+    setCongested(bytesToWrite() >= c_highWaterMark);
 }
 
 qint64 SocketHelper::write(const QByteArray &data) {
     qint64 bytes = 0;
     if (m_webSocket) {
-        bytes = m_webSocket->sendTextMessage(data);
+        // the commands are sent as they are, a text frame would only make both sides validate the UTF-8 for nothing
+        bytes = m_webSocket->sendBinaryMessage(data);
+        m_webSocketBytesToWrite += bytes;
     }
 #ifndef Q_OS_WASM
     if (m_tcpSocket) {
         bytes = m_tcpSocket->write(data);
     }
 #endif // Q_OS_WASM
-    if (bytes != data.count()) {
-        qWarning() << "fetchLines: Attempted to write" << data.count() << "but managed to write" << bytes;
+    if (bytes > 0)
+        m_stats.bytesSent += bytes;
+    if (bytes != data.size()) {
+        qWarning() << "Attempted to write" << data.size() << "but managed to write" << bytes;
     }
     return bytes;
 }
 
+void SocketHelper::onBytesWritten(qint64 bytes) {
+    if (m_webSocket)
+        m_webSocketBytesToWrite = qMax<qint64>(0, m_webSocketBytesToWrite - bytes);
+    if (bytesToWrite() > c_lowWaterMark)
+        return;
+    if (!m_outgoing.isEmpty())
+        flush();
+    else
+        setCongested(false);
+}
+
 void SocketHelper::reset() {
+    // commands for the previous connection make no sense on the next one
+    m_outgoing.resize(0);
+    m_urgent.resize(0);
+    m_outgoingTags.clear();
+    m_urgentTags.clear();
+    m_replaceable.clear();
+    m_webSocketBytesToWrite = 0;
+    setCongested(false);
+    m_stats = ConnectionStats();
+    // the old socket would still report its disconnection, which would count as a failure of the new attempt
     if (m_webSocket) {
+        m_webSocket->disconnect(this);
         m_webSocket->deleteLater();
         m_webSocket = nullptr;
     }
 #ifndef Q_OS_WASM
     if (m_tcpSocket) {
+        m_tcpSocket->disconnect(this);
         m_tcpSocket->deleteLater();
         m_tcpSocket = nullptr;
     }
+    m_bytesRemaining = 0;
+    m_streaming = false;
+    m_frameDecompressTime = 0;
+    m_receiveBuffer.clear();
 #endif // Q_OS_WASM
+    finishDecompression();
+    m_inflater.resetCounters();
+#ifdef HAVE_ZSTD
+    m_zstdDecoder.resetCounters();
+#endif // HAVE_ZSTD
+}
+
+QStringList SocketHelper::supportedCompression() {
+#ifdef HAVE_ZSTD
+    return { "zstd", "zlib" };
+#else
+    return { "zlib" };
+#endif // HAVE_ZSTD
+}
+
+qint64 SocketHelper::compressedBytes() const {
+#ifdef HAVE_ZSTD
+    return m_inflater.compressedBytes() + m_zstdDecoder.compressedBytes();
+#else
+    return m_inflater.compressedBytes();
+#endif // HAVE_ZSTD
+}
+
+qint64 SocketHelper::decompressedBytes() const {
+#ifdef HAVE_ZSTD
+    return m_inflater.decompressedBytes() + m_zstdDecoder.decompressedBytes();
+#else
+    return m_inflater.decompressedBytes();
+#endif // HAVE_ZSTD
+}
+
+bool SocketHelper::startDecompression(quint8 compression) {
+    m_compression = compression;
+    switch (compression) {
+    case NO_COMPRESSION:
+        return true;
+    case ZLIB:
+        return m_inflater.start();
+#ifdef HAVE_ZSTD
+    case ZSTD:
+        return m_zstdDecoder.start();
+#endif // HAVE_ZSTD
+    default:
+        qCritical() << "The server sent a message compressed with an unknown algorithm:" << compression;
+        return false;
+    }
+}
+
+bool SocketHelper::decompress(QByteArrayView input, QByteArray &output) {
+#ifdef HAVE_ZSTD
+    if (m_compression == ZSTD)
+        return m_zstdDecoder.feed(input, output);
+#endif // HAVE_ZSTD
+    return m_inflater.feed(input, output);
+}
+
+bool SocketHelper::finishDecompression() {
+    auto ended = m_inflater.finish();
+#ifdef HAVE_ZSTD
+    ended = m_zstdDecoder.finish() && ended;
+#endif // HAVE_ZSTD
+    return ended;
 }
 
 void SocketHelper::onBinaryMessageReceived(const QByteArray &data) {
-    if (data.size() > 5) {
-        auto header = data.left(5);
-        if (header.size() != 5) {
-            return;
-        }
-        qint32 bytes;
-        bool compressed;
-        QDataStream s(&header, QIODevice::ReadOnly);
-        s >> bytes >> compressed;
-        if (bytes <= 5) {
+    // each WebSocket frame carries one whole message, it's handed over as it is
+    m_stats.bytesReceived += data.size();
+    if (data.size() > c_headerSize) {
+        m_stats.frames++;
+        auto bytes = qFromBigEndian<qint32>(data.constData());
+        quint8 compression = data[4];
+        if (bytes <= c_headerSize) {
             qCritical() << "The server sent a message header saying the message is shorter than 5 bytes, that doesn't make sense";
             m_webSocket->close();
             reset();
             return;
         }
-        QByteArray dataCopy;
-        if (compressed) {
-            dataCopy = data.mid(1);
-            dataCopy[0] = 0;
-            dataCopy[1] = 0;
-            dataCopy[2] = 0;
-            dataCopy[3] = 0;
-            dataCopy = qUncompress(dataCopy);
+        if (compression != NO_COMPRESSION) {
+            QElapsedTimer timer;
+            timer.start();
+            QByteArray inflated;
+            if (!startDecompression(compression) || !decompress(QByteArrayView(data).sliced(c_headerSize), inflated)) {
+                qCritical() << "Failed to decompress a message from the server";
+                m_webSocket->close();
+                reset();
+                return;
+            }
+            if (!finishDecompression()) {
+                qCritical() << "A compressed message from the server was cut short";
+                m_webSocket->close();
+                reset();
+                return;
+            }
+            m_stats.decompressTime.record(timer.nsecsElapsed() / 1000);
+            m_stats.bytesDecompressed += inflated.size();
+            emit messageReceived(inflated, 0);
         }
         else {
-            dataCopy = data.mid(5);
+            m_stats.bytesDecompressed += data.size() - c_headerSize;
+            emit messageReceived(data, c_headerSize);
         }
-        emit dataReceived(dataCopy);
     }
 }
 
@@ -175,64 +499,97 @@ void SocketHelper::onSslErrors(const QList<QSslError> &errors) {
 }
 
 void SocketHelper::onReadyRead() {
-    m_timeoutTimer->stop();
-
     if (!m_tcpSocket) {
         // this shouldn't really happen, yet it seems it probably does
         return;
     }
 
-    // In the protocol parser, there's the call to processEvents that could lead to
-    // this slot being called while a message is already being processed
-    // This is guard that prevents processing of more messages at the same moment
-    static bool guard = false;
-    if (guard)
-        return;
-
-    static bool compressed = false;
+    // everything that has arrived is framed in this one pass, a burst of small messages doesn't need a round per message
+    forever {
+        m_stats.bytesReceived += m_receiveBuffer.fill(m_tcpSocket);
+        if (!processFrame())
+            break;
+    }
+}
 
+bool SocketHelper::processFrame() {
     // not waiting for the rest of any message, get a new header
     if (m_bytesRemaining == 0) {
-        auto header = m_tcpSocket->read(5);
-        if (header.size() != 5) {
-            return;
-        }
-        QDataStream s(&header, QIODevice::ReadOnly);
-        s >> m_bytesRemaining >> compressed;
-        if (m_bytesRemaining <= 5) {
+        if (m_receiveBuffer.size() < c_headerSize)
+            return false;
+        char header[c_headerSize];
+        m_receiveBuffer.read(header, c_headerSize);
+        auto length = qFromBigEndian<qint32>(header);
+        quint8 compression = header[4];
+        if (length <= c_headerSize) {
             qCritical() << "The server sent a message header saying the message is shorter than 5 bytes, that doesn't make sense";
+            m_receiveBuffer.clear();
             m_tcpSocket->disconnectFromHost();
-            return;
+            return false;
+        }
+        m_bytesRemaining = length - c_headerSize;
+        // messages that fit in the buffer are passed on whole, only the huge ones go in parts as they arrive
+        // so the parser doesn't have to wait for all of it
+        m_streaming = m_bytesRemaining > m_receiveBuffer.capacity();
+        if (!startDecompression(compression)) {
+            qCritical() << "Failed to initialize decompression";
+            m_tcpSocket->disconnectFromHost();
+            return false;
         }
-        m_bytesRemaining -= 5;
-        m_fetchBuffer.clear();
-        // add a header to the data if compressed, containing the expected length of the data
-        // Qt doesn't seem to care if it's correct so just put 0 in there
-        if (compressed)
-            m_fetchBuffer.append(4, 0);
-    }
-
-    // continue in whatever message came before (be it from a previous readyRead or this one
-    if (m_bytesRemaining > 0) {
-        auto cache = m_tcpSocket->read(m_bytesRemaining);
-        m_bytesRemaining -= cache.count();
-        m_fetchBuffer.append(cache);
     }
 
-    // one message has been received in full, process it
-    if (m_bytesRemaining == 0) {
-        if (compressed) {
-            m_fetchBuffer = qUncompress(m_fetchBuffer);
+    if (!m_streaming && m_receiveBuffer.size() < m_bytesRemaining)
+        return false;
+    auto available = qMin<qsizetype>(m_receiveBuffer.size(), m_bytesRemaining);
+    if (available == 0)
+        return false;
+
+    QByteArray chunk;
+    if (m_compression != NO_COMPRESSION) {
+        QElapsedTimer timer;
+        timer.start();
+        // the compressed data is inflated right from the buffer, it can come in two parts if it wraps around
+        while (available > 0) {
+            auto span = m_receiveBuffer.front(available);
+            if (!decompress(span, chunk)) {
+                qCritical() << "Failed to decompress a message from the server";
+                finishDecompression();
+                m_receiveBuffer.clear();
+                m_tcpSocket->disconnectFromHost();
+                return false;
+            }
+            m_receiveBuffer.skip(span.size());
+            available -= span.size();
+            m_bytesRemaining -= span.size();
+        }
+        m_frameDecompressTime += timer.nsecsElapsed();
+        // the last piece has to end the compressed stream too, otherwise the message was cut short
+        if (m_bytesRemaining == 0 && !finishDecompression()) {
+            qCritical() << "A compressed message from the server was cut short";
+            m_receiveBuffer.clear();
+            m_tcpSocket->disconnectFromHost();
+            return false;
         }
-        guard = true;
-        emit dataReceived(m_fetchBuffer);
-        guard = false;
-        m_fetchBuffer.clear();
     }
+    else {
+        // allocated once, for a message that fits in the buffer this is the whole payload
+        chunk = QByteArray(available, Qt::Uninitialized);
+        m_receiveBuffer.read(chunk.data(), available);
+        m_bytesRemaining -= available;
+    }
+    m_stats.bytesDecompressed += chunk.size();
+    if (!chunk.isEmpty())
+        emit dataReceived(chunk);
 
-    // if there's still more data left, do one more round
-    if (m_tcpSocket && m_tcpSocket->bytesAvailable()) {
-        onReadyRead();
+    // one message has been received in full
+    if (m_bytesRemaining == 0) {
+        m_stats.frames++;
+        if (m_compression != NO_COMPRESSION)
+            m_stats.decompressTime.record(m_frameDecompressTime / 1000);
+        m_frameDecompressTime = 0;
+        finishDecompression();
+        emit messageFinished();
     }
+    return true;
 }
 #endif // Q_OS_WASM
@@ -1,8 +1,17 @@
 #ifndef SOCKETHELPER_H
 #define SOCKETHELPER_H
 
+#include "command.h"
+#include "connectionmetrics.h"
+#include "inflater.h"
+#include "ringbuffer.h"
+#include "zstddecoder.h"
+
 #include <QObject>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QHostAddress>
 
 #include <QtWebSockets/QWebSocket>
 #ifndef Q_OS_WASM
@@ -20,6 +29,29 @@ public:
 
     Weechat *weechat();
 
+    // starts a new command in the outgoing buffer, see Command
+    Command command();
+
+    // the value of the compression byte in the message header
+    enum Compression : quint8 {
+        NO_COMPRESSION = 0,
+        ZLIB = 1,
+        ZSTD = 2,
+    };
+    // names of the algorithms this build can decompress, as the relay knows them
+    static QStringList supportedCompression();
+
+    // commands are held back while more than c_highWaterMark bytes wait in the socket
+    bool isCongested() const { return m_congested; }
+    qint64 queuedBytes() const { return m_outgoing.size(); }
+
+    // counters of the current connection, Weechat adds its own measurements
+    ConnectionStats &stats() { return m_stats; }
+
+    // compression statistics of the current connection
+    qint64 compressedBytes() const;
+    qint64 decompressedBytes() const;
+
 public slots:
     void reset();
 
@@ -28,20 +60,31 @@ public slots:
     void connectToTcpSocket(const QString &hostname, int port, bool encrypted);
 #endif // Q_OS_WASM
 
-    qint64 write(const char *data);
-    qint64 write(const QString &data);
-    qint64 write(const QByteArray &data);
+    // sends everything queued by command() right away
+    void flush();
+#ifndef Q_OS_WASM
+    // resolves the hostname ahead of time, if it's not known already
+    void warmUp(const QString &hostname);
+#endif // Q_OS_WASM
 
 signals:
     void connected();
     void disconnected();
+    // a decompressed part of the message currently being received, messageFinished follows the last one
     void dataReceived(const QByteArray &data);
+    void messageFinished();
+    // a whole message at once, its payload starts at offset (behind the header, it's not copied out)
+    void messageReceived(const QByteArray &data, qsizetype offset);
     void errorOccurred(const QString &message);
+    void congestionChanged(bool congested);
+    // the tagged commands just handed over to the socket, see Command::tagged
+    void commandsWritten(const QList<qint64> &tags);
 
 private slots:
     void onError(QAbstractSocket::SocketError e);
     void onDisconnected();
     void onConnected();
+    void onBytesWritten(qint64 bytes);
 
 #ifndef Q_OS_WASM
     void onReadyRead();
@@ -50,13 +93,86 @@ private slots:
 
     void onBinaryMessageReceived(const QByteArray &data);
 private:
-    QTimer *m_timeoutTimer { new QTimer(this) };
+    friend class Command;
+    void commandQueued(const QByteArray &key, qsizetype start, bool urgent, qint64 tag);
+    void scheduleFlush();
+    qint64 write(const QByteArray &data);
+    // what was written to the socket but didn't make it to the network yet
+    qint64 bytesToWrite() const;
+    void setCongested(bool congested);
+
+    static constexpr qsizetype c_maxRetainedOutgoing { 64 * 1024 };
+    static constexpr qint64 c_highWaterMark { 64 * 1024 };
+    static constexpr qint64 c_lowWaterMark { 16 * 1024 };
+    // 4 bytes of length, 1 byte of compression
+    static constexpr qint32 c_headerSize { 5 };
+#ifndef Q_OS_WASM
+    static constexpr qsizetype c_receiveBufferSize { 256 * 1024 };
+
+    // handles what's in the receive buffer, returns false when it needs more data
+    bool processFrame();
+
+    // dead connections are noticed in about idle + interval * count seconds, or when sent data isn't acknowledged in time
+    static constexpr int c_keepAliveIdle { 10 };
+    static constexpr int c_keepAliveInterval { 5 };
+    static constexpr int c_keepAliveCount { 3 };
+    static constexpr unsigned int c_userTimeout { 30000 };
+    static void configureKeepAlive(qintptr descriptor);
+
+    // TLS sessions and addresses survive the sockets, a reconnection can skip the full handshake and the DNS lookup
+    static constexpr qint64 c_addressCacheTtl { 10 * 60 * 1000 };
+    QSslConfiguration resumableSslConfiguration(QSslConfiguration configuration) const;
+    QString sessionKey() const;
+    void storeSessionTicket();
+    QHostAddress cachedAddress(const QString &hostname) const;
+#endif // Q_OS_WASM
+
+    bool startDecompression(quint8 compression);
+    bool decompress(QByteArrayView input, QByteArray &output);
+    // returns false when the message was cut short in the middle of its compressed stream
+    bool finishDecompression();
 
     QWebSocket *m_webSocket { nullptr };
+    QByteArray m_outgoing;
+    // urgent commands queued while congested, written even when m_outgoing is held back
+    QByteArray m_urgent;
+    // tags of the commands in each of the buffers
+    QList<qint64> m_outgoingTags;
+    QList<qint64> m_urgentTags;
+    bool m_flushScheduled { false };
+    bool m_congested { false };
+    // where the replaceable commands are in m_outgoing
+    struct Replaceable {
+        QByteArray key;
+        qsizetype offset;
+        qsizetype size;
+        qint64 tag;
+    };
+    QList<Replaceable> m_replaceable;
+    // QWebSocket doesn't say how much it still has to send, count it here
+    qint64 m_webSocketBytesToWrite { 0 };
+    Inflater m_inflater;
+#ifdef HAVE_ZSTD
+    ZstdDecoder m_zstdDecoder;
+#endif // HAVE_ZSTD
+    quint8 m_compression { NO_COMPRESSION };
+    ConnectionStats m_stats;
 #ifndef Q_OS_WASM
     QSslSocket *m_tcpSocket { nullptr };
-    QByteArray m_fetchBuffer;
+    RingBuffer m_receiveBuffer { c_receiveBufferSize };
     qint32 m_bytesRemaining { 0 };
+    bool m_streaming { false };
+    // nanoseconds spent decompressing the message being received so far
+    qint64 m_frameDecompressTime { 0 };
+
+    QString m_hostname;
+    int m_port { 0 };
+    QHash<QString, QByteArray> m_sessionTickets;
+    struct AddressCacheEntry {
+        QHostAddress address;
+        QElapsedTimer resolved;
+    };
+    QHash<QString, AddressCacheEntry> m_addressCache;
 #endif // Q_OS_WASM
 };
 
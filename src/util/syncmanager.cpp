@@ -0,0 +1,60 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "syncmanager.h"
+
+SyncManager::Change SyncManager::select(pointer_t ptr) {
+    Change change;
+    change.promoted = !isFullySynced(ptr);
+    m_recent.removeOne(ptr);
+    m_recent.prepend(ptr);
+    if (m_recent.count() > c_maxRecent) {
+        auto last = m_recent.takeLast();
+        if (!m_pinned.contains(last))
+            change.demoted = last;
+    }
+    return change;
+}
+
+bool SyncManager::pin(pointer_t ptr) {
+    auto promoted = !isFullySynced(ptr);
+    m_pinned.insert(ptr);
+    return promoted;
+}
+
+void SyncManager::remove(pointer_t ptr) {
+    m_recent.removeOne(ptr);
+    m_pinned.remove(ptr);
+}
+
+void SyncManager::clear() {
+    m_recent.clear();
+    m_pinned.clear();
+}
+
+bool SyncManager::isFullySynced(pointer_t ptr) const {
+    return m_pinned.contains(ptr) || m_recent.contains(ptr);
+}
+
+QList<pointer_t> SyncManager::fullySynced() const {
+    auto result = m_recent;
+    for (auto ptr : m_pinned) {
+        if (!result.contains(ptr))
+            result.append(ptr);
+    }
+    return result;
+}
@@ -0,0 +1,55 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef SYNCMANAGER_H
+#define SYNCMANAGER_H
+
+#include "common.h"
+
+#include <QList>
+#include <QSet>
+
+// Decides which buffers the relay pushes lines and nicklist changes for
+// The recently selected buffers and the pinned ones are synced fully, the rest only get the buffer events
+class SyncManager {
+public:
+    static constexpr int c_maxRecent { 8 };
+
+    struct Change {
+        // the buffer wasn't fully synced before, what it missed has to be fetched
+        bool promoted { false };
+        // a buffer that dropped out of the recently selected ones, 0 if none did
+        pointer_t demoted { 0 };
+    };
+
+    Change select(pointer_t ptr);
+    // returns true if the buffer wasn't fully synced before
+    bool pin(pointer_t ptr);
+    // the buffer is gone, its pointer may be handed out again for another one
+    void remove(pointer_t ptr);
+    void clear();
+
+    bool isFullySynced(pointer_t ptr) const;
+    QList<pointer_t> fullySynced() const;
+
+private:
+    // most recently selected first
+    QList<pointer_t> m_recent;
+    QSet<pointer_t> m_pinned;
+};
+
+#endif // SYNCMANAGER_H
@@ -0,0 +1,171 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#include "tracefile.h"
+
+#include <QDebug>
+
+namespace {
+// in the as-fast-as-possible mode, give the event loop a chance to run after this many records
+constexpr int c_replayBatch { 256 };
+}
+
+QString Trace::recordPath() {
+    return qEnvironmentVariable("LITH_TRACE_RECORD");
+}
+
+QString Trace::replayPath() {
+    return qEnvironmentVariable("LITH_TRACE_REPLAY");
+}
+
+TraceWriter::TraceWriter(const QString &path, QObject *parent)
+    : QObject(parent)
+    , m_file(path)
+{
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qCritical() << "Could not open" << path << "to record the relay traffic:" << m_file.errorString();
+        return;
+    }
+    m_stream.setDevice(&m_file);
+    m_stream.setVersion(QDataStream::Qt_6_0);
+    m_stream << Trace::c_magic << Trace::c_version;
+    m_elapsed.start();
+    qInfo() << "Recording the relay traffic to" << path;
+}
+
+TraceWriter::~TraceWriter() {
+    if (m_file.isOpen())
+        m_file.flush();
+}
+
+bool TraceWriter::isOpen() const {
+    return m_file.isOpen();
+}
+
+void TraceWriter::writeData(const QByteArray &data) {
+    if (!m_file.isOpen())
+        return;
+    m_stream << quint8(Trace::DATA) << qint64(m_elapsed.nsecsElapsed() / 1000) << data;
+}
+
+void TraceWriter::writeMessageEnd() {
+    if (!m_file.isOpen())
+        return;
+    m_stream << quint8(Trace::MESSAGE_END) << qint64(m_elapsed.nsecsElapsed() / 1000);
+    // one flush per message, a crash only loses the message in progress
+    m_file.flush();
+}
+
+void TraceWriter::writeMessage(const QByteArray &data, qsizetype offset) {
+    if (!m_file.isOpen())
+        return;
+    auto payload = QByteArrayView(data).sliced(offset);
+    m_stream << quint8(Trace::DATA) << qint64(m_elapsed.nsecsElapsed() / 1000);
+    // same layout as QDataStream uses for a QByteArray, without making one
+    m_stream << quint32(payload.size());
+    m_stream.writeRawData(payload.data(), payload.size());
+    writeMessageEnd();
+}
+
+TraceReplayer::TraceReplayer(const QString &path, double speed, QObject *parent)
+    : QObject(parent)
+    , m_file(path)
+    , m_speed(speed)
+{
+    m_timer->setSingleShot(true);
+    connect(m_timer, &QTimer::timeout, this, &TraceReplayer::onTimeout);
+
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qCritical() << "Could not open the relay trace" << path << ":" << m_file.errorString();
+        return;
+    }
+    m_stream.setDevice(&m_file);
+    m_stream.setVersion(QDataStream::Qt_6_0);
+    quint32 magic = 0, version = 0;
+    m_stream >> magic >> version;
+    if (magic != Trace::c_magic || version != Trace::c_version) {
+        qCritical() << "File" << path << "is not a relay trace this version of Lith can read";
+        m_file.close();
+    }
+}
+
+bool TraceReplayer::isOpen() const {
+    return m_file.isOpen();
+}
+
+void TraceReplayer::start() {
+    if (!m_file.isOpen()) {
+        emit finished();
+        return;
+    }
+    qInfo() << "Replaying the relay trace" << m_file.fileName() << "at speed" << m_speed;
+    m_elapsed.start();
+    m_timer->start(0);
+}
+
+bool TraceReplayer::readRecord() {
+    m_data.clear();
+    m_stream >> m_type >> m_timestamp;
+    if (m_type == Trace::DATA)
+        m_stream >> m_data;
+    if (m_stream.status() != QDataStream::Ok)
+        return false;
+    // the time before the first message (connecting, handshake) is not interesting
+    if (m_firstTimestamp < 0)
+        m_firstTimestamp = m_timestamp;
+    return true;
+}
+
+void TraceReplayer::onTimeout() {
+    int delivered = 0;
+    forever {
+        if (!m_pending) {
+            if (!readRecord()) {
+                if (m_stream.status() != QDataStream::ReadPastEnd || !m_stream.atEnd())
+                    qCritical() << "The relay trace" << m_file.fileName() << "is corrupted";
+                qInfo() << "Replayed" << m_messages << "messages," << m_bytes << "bytes in" << m_elapsed.elapsed() << "ms";
+                m_file.close();
+                emit finished();
+                return;
+            }
+            m_pending = true;
+        }
+
+        if (m_speed > 0.0) {
+            auto due = qint64((m_timestamp - m_firstTimestamp) / 1000 / m_speed);
+            auto now = m_elapsed.elapsed();
+            if (due > now) {
+                m_timer->start(due - now);
+                return;
+            }
+        }
+        else if (delivered >= c_replayBatch) {
+            m_timer->start(0);
+            return;
+        }
+
+        m_pending = false;
+        delivered++;
+        if (m_type == Trace::DATA) {
+            m_bytes += m_data.size();
+            emit dataReceived(m_data);
+        }
+        else if (m_type == Trace::MESSAGE_END) {
+            m_messages++;
+            emit messageFinished();
+        }
+    }
+}
@@ -0,0 +1,107 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef TRACEFILE_H
+#define TRACEFILE_H
+
+#include <QObject>
+#include <QFile>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QTimer>
+
+// Decompressed relay traffic recorded to a file and played back later, to reproduce and profile slowdowns offline
+//
+// Enabled through environment variables:
+//   LITH_TRACE_RECORD=<file>        records everything received from the relay
+//   LITH_TRACE_REPLAY=<file>        doesn't connect anywhere, plays the file back instead
+//   LITH_TRACE_REPLAY_SPEED=<n>     1 is the original speed (default), 0 is as fast as possible
+//
+// The file starts with a magic and a version, followed by records of
+//   quint8 type, qint64 microseconds since the recording started, and for data records the chunk as a QByteArray
+// Chunks are stored exactly as SocketHelper emitted them, so replaying goes through the same streaming path
+namespace Trace {
+    inline constexpr quint32 c_magic { 0x4c545243 }; // "LTRC"
+    inline constexpr quint32 c_version { 1 };
+
+    enum RecordType : quint8 {
+        DATA = 0,
+        MESSAGE_END = 1,
+    };
+
+    QString recordPath();
+    QString replayPath();
+}
+
+class TraceWriter : public QObject {
+    Q_OBJECT
+public:
+    TraceWriter(const QString &path, QObject *parent = nullptr);
+    ~TraceWriter();
+
+    bool isOpen() const;
+
+public slots:
+    void writeData(const QByteArray &data);
+    void writeMessageEnd();
+    void writeMessage(const QByteArray &data, qsizetype offset);
+
+private:
+    QFile m_file;
+    QDataStream m_stream;
+    QElapsedTimer m_elapsed;
+};
+
+class TraceReplayer : public QObject {
+    Q_OBJECT
+public:
+    // speed multiplies the original pace, zero or less replays as fast as possible
+    TraceReplayer(const QString &path, double speed = 1.0, QObject *parent = nullptr);
+
+    bool isOpen() const;
+
+public slots:
+    void start();
+
+signals:
+    void dataReceived(const QByteArray &data);
+    void messageFinished();
+    void finished();
+
+private slots:
+    void onTimeout();
+
+private:
+    bool readRecord();
+
+    QFile m_file;
+    QDataStream m_stream;
+    QElapsedTimer m_elapsed;
+    QTimer *m_timer { new QTimer(this) };
+    double m_speed { 1.0 };
+
+    // the record read ahead, waiting for its time to come
+    bool m_pending { false };
+    quint8 m_type { Trace::DATA };
+    qint64 m_timestamp { 0 };
+    qint64 m_firstTimestamp { -1 };
+    QByteArray m_data;
+
+    qint64 m_messages { 0 };
+    qint64 m_bytes { 0 };
+};
+
+#endif // TRACEFILE_H
@@ -0,0 +1,80 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#include "zstddecoder.h"
+
+#ifdef HAVE_ZSTD
+
+#include <QDebug>
+
+ZstdDecoder::~ZstdDecoder() {
+    ZSTD_freeDCtx(m_context);
+}
+
+bool ZstdDecoder::start() {
+    m_active = false;
+    if (!m_context) {
+        m_context = ZSTD_createDCtx();
+        if (!m_context)
+            return false;
+    }
+    else if (ZSTD_isError(ZSTD_DCtx_reset(m_context, ZSTD_reset_session_only))) {
+        return false;
+    }
+    if (m_arena.isEmpty())
+        m_arena.resize(ZSTD_DStreamOutSize());
+    m_active = true;
+    m_ended = false;
+    return true;
+}
+
+bool ZstdDecoder::feed(QByteArrayView input, QByteArray &output) {
+    if (!m_active)
+        return false;
+
+    m_compressedBytes += input.size();
+    ZSTD_inBuffer in { input.data(), static_cast<size_t>(input.size()), 0 };
+    forever {
+        ZSTD_outBuffer out { m_arena.data(), static_cast<size_t>(m_arena.size()), 0 };
+        auto ret = ZSTD_decompressStream(m_context, &out, &in);
+        if (ZSTD_isError(ret)) {
+            qCritical() << "zstd decompression failed:" << ZSTD_getErrorName(ret);
+            return false;
+        }
+        output.append(m_arena.constData(), static_cast<qsizetype>(out.pos));
+        m_decompressedBytes += static_cast<qsizetype>(out.pos);
+        // 0 means the frame was decoded and flushed completely
+        m_ended = ret == 0;
+        // a full arena means there may be more output waiting even when all the input was consumed
+        if (out.pos < out.size && in.pos == in.size)
+            return true;
+        if (out.pos == out.size && m_arena.size() < c_maxArenaSize)
+            m_arena.resize(m_arena.size() * 2);
+    }
+}
+
+bool ZstdDecoder::finish() {
+    auto ended = !m_active || m_ended;
+    m_active = false;
+    return ended;
+}
+
+void ZstdDecoder::resetCounters() {
+    m_compressedBytes = 0;
+    m_decompressedBytes = 0;
+}
+
+#endif // HAVE_ZSTD
@@ -0,0 +1,62 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ZSTDDECODER_H
+#define ZSTDDECODER_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+
+// Streaming zstd decompression of compressed messages, the counterpart of Inflater
+// The decompression context and the output arena are reused for every message of the connection
+class ZstdDecoder {
+public:
+    ZstdDecoder() = default;
+    ~ZstdDecoder();
+    ZstdDecoder(const ZstdDecoder &) = delete;
+    ZstdDecoder &operator=(const ZstdDecoder &) = delete;
+
+    // starts decompressing a new message, drops the state of the previous one
+    bool start();
+    // decompresses the next piece of the message, appends whatever comes out of it to output
+    bool feed(QByteArrayView input, QByteArray &output);
+    // returns false when the message ended before the compressed frame did
+    bool finish();
+
+    bool isActive() const { return m_active; }
+
+    qint64 compressedBytes() const { return m_compressedBytes; }
+    qint64 decompressedBytes() const { return m_decompressedBytes; }
+    void resetCounters();
+
+private:
+    static constexpr qsizetype c_maxArenaSize { 4 * 1024 * 1024 };
+
+    ZSTD_DCtx *m_context { nullptr };
+    bool m_active { false };
+    bool m_ended { false };
+    QByteArray m_arena;
+
+    qint64 m_compressedBytes { 0 };
+    qint64 m_decompressedBytes { 0 };
+};
+
+#endif // HAVE_ZSTD
+
+#endif // ZSTDDECODER_H
@@ -18,11 +18,17 @@
 #include "weechat.h"
 
 #include "lith.h"
+#include "util/tracefile.h"
 #include "protocol.h"
 
 #include <QThread>
+#include <QGuiApplication>
+
+#include <cstring>
+#include <iterator>
 
 #include <QPasswordDigestor>
+#include <QRegularExpression>
 #include <QCryptographicHash>
 #include <QRandomGenerator>
 
@@ -32,18 +38,44 @@ Weechat::Weechat(Lith *lith)
     , m_lith(lith)
 {
     connect(m_connection, &SocketHelper::dataReceived, this, &Weechat::onDataReceived, Qt::QueuedConnection);
+    connect(m_connection, &SocketHelper::messageFinished, this, &Weechat::onMessageFinished, Qt::QueuedConnection);
+    connect(m_connection, &SocketHelper::messageReceived, this, &Weechat::onMessageReceived, Qt::QueuedConnection);
     connect(m_connection, &SocketHelper::connected, this, &Weechat::onConnected, Qt::QueuedConnection);
     connect(m_connection, &SocketHelper::disconnected, this, &Weechat::onDisconnected, Qt::QueuedConnection);
     connect(m_connection, &SocketHelper::errorOccurred, this, &Weechat::onError, Qt::QueuedConnection);
+    connect(m_connection, &SocketHelper::congestionChanged, this, [this](bool congested) {
+        QMetaObject::invokeMethod(m_lith, [this, congested]() {
+            m_lith->sendQueueCongestedSet(congested);
+        }, Qt::QueuedConnection);
+    });
+    // direct, the deadlines have to be running before anything else gets read from the socket
+    connect(m_connection, &SocketHelper::commandsWritten, this, [this](const QList<qint64> &tags) {
+        for (auto tag : tags) {
+            if (tag == c_pingTag)
+                onPingWritten();
+            else
+                m_requests->sent(tag);
+        }
+    });
 
-    connect(lith, &Lith::pongReceived, this, &Weechat::onPongReceived, Qt::QueuedConnection);
     connect(m_pingTimer, &QTimer::timeout, this, &Weechat::onPingTimeout, Qt::QueuedConnection);
     m_pingTimer->setSingleShot(false);
     m_pingTimer->start(5000);
+    connect(m_livenessTimer, &QTimer::timeout, this, &Weechat::onLivenessTimeout, Qt::QueuedConnection);
+    m_livenessTimer->setSingleShot(true);
+
+    // the measurements are passed to the GUI thread once a second
+    connect(m_metricsTimer, &QTimer::timeout, this, &Weechat::publishMetrics);
+    m_metricsTimer->setSingleShot(false);
+    m_metricsTimer->start(1000);
+    m_metricsElapsed.start();
 
     connect(m_reconnectTimer, &QTimer::timeout, this, &Weechat::restart, Qt::QueuedConnection);
-    m_reconnectTimer->setInterval(100);
-    m_reconnectTimer->setSingleShot(false);
+    m_reconnectTimer->setSingleShot(true);
+    // an attempt that neither connects nor fails in time counts as failed
+    connect(m_connectTimeoutTimer, &QTimer::timeout, this, &Weechat::scheduleReconnect, Qt::QueuedConnection);
+    m_connectTimeoutTimer->setInterval(c_connectTimeout);
+    m_connectTimeoutTimer->setSingleShot(true);
 }
 
 Lith *Weechat::lith() {
@@ -93,19 +125,24 @@ QByteArray Weechat::randomString(int length) {
 }
 
 void Weechat::init() {
-    m_timeoutTimer->setInterval(5000);
-    m_timeoutTimer->setSingleShot(true);
-    //connect(m_timeoutTimer, &QTimer::timeout, this, &Weechat::onTimeout, Qt::QueuedConnection);
+    connect(qGuiApp, &QGuiApplication::applicationStateChanged, this, &Weechat::onApplicationStateChanged, Qt::QueuedConnection);
 
     connect(m_hotlistTimer, &QTimer::timeout, this, &Weechat::requestHotlist, Qt::QueuedConnection);
     m_hotlistTimer->setInterval(10000);
     m_hotlistTimer->setSingleShot(false);
 
+    auto replayPath = Trace::replayPath();
+    if (!replayPath.isEmpty()) {
+        startReplay(replayPath);
+        return;
+    }
+
     connect(lith()->settingsGet(), &Settings::ready, this, &Weechat::onConnectionSettingsChanged, Qt::QueuedConnection);
     connect(lith()->settingsGet(), &Settings::hostChanged, this, &Weechat::onConnectionSettingsChanged, Qt::QueuedConnection);
     connect(lith()->settingsGet(), &Settings::passphraseChanged, this, &Weechat::onConnectionSettingsChanged, Qt::QueuedConnection);
     connect(lith()->settingsGet(), &Settings::portChanged, this, &Weechat::onConnectionSettingsChanged, Qt::QueuedConnection);
     connect(lith()->settingsGet(), &Settings::encryptedChanged, this, &Weechat::onConnectionSettingsChanged, Qt::QueuedConnection);
+    connect(lith()->settingsGet(), &Settings::selectiveSyncChanged, this, &Weechat::onConnectionSettingsChanged, Qt::QueuedConnection);
 
     onConnectionSettingsChanged();
 }
@@ -113,6 +150,12 @@ void Weechat::init() {
 void Weechat::start() {
     m_connection->reset();
     m_restarting = false;
+    // new settings, start counting the attempts from scratch
+    m_reconnectPolicy.reset();
+    // and the model may be from a different relay
+    m_modelValid = false;
+    m_sync.clear();
+    m_cursorPaging = CURSOR_PAGING_UNKNOWN;
     qCritical() << "Connecting";
 
     lith()->statusSet(Lith::CONNECTING);
@@ -120,7 +163,31 @@ void Weechat::start() {
     restart();
 }
 
+void Weechat::startReplay(const QString &path) {
+    bool ok = false;
+    auto speed = qEnvironmentVariable("LITH_TRACE_REPLAY_SPEED", "1").toDouble(&ok);
+    if (!ok)
+        speed = 1.0;
+
+    // the recorded messages go through the same slots as the ones coming from the socket
+    auto replayer = new TraceReplayer(path, speed, this);
+    connect(replayer, &TraceReplayer::dataReceived, this, &Weechat::onDataReceived);
+    connect(replayer, &TraceReplayer::messageFinished, this, &Weechat::onMessageFinished);
+    connect(replayer, &TraceReplayer::finished, this, [this]() {
+        lith()->statusSet(Lith::DISCONNECTED);
+    });
+
+    m_parser.reset();
+    m_modelValid = false;
+    QTimer::singleShot(0, lith(), &Lith::resetData);
+    lith()->statusSet(Lith::CONNECTED);
+    replayer->start();
+}
+
 void Weechat::restart() {
+    m_reconnectTimer->stop();
+    m_connectTimeoutTimer->start();
+    m_connectStarted.start();
     m_initializationStatus = UNINITIALIZED;
     auto host = lith()->settingsGet()->hostGet();
     auto port = lith()->settingsGet()->portGet();
@@ -162,6 +229,7 @@ void Weechat::onHandshakeAccepted(const StringMap &data) {
 
     QString hashString;
     if (algo == "plain")
+        // compression in init is only understood by old relays that don't know anything but zlib
         hashString = "password=" + pass + ",compression=" + (lith()->settingsGet()->connectionCompressionGet() ? "zlib" : "off");
     else if (algo.startsWith("pbkdf2"))
         hashString = "password_hash=" + algo + ':' + salt.toHex() + ':' + QString("%1").arg(iterations) + ':' + hash.toHex();
@@ -170,18 +238,99 @@ void Weechat::onHandshakeAccepted(const StringMap &data) {
 
     m_initializationStatus = (Initialization) (m_initializationStatus | HANDSHAKE);
 
-    m_connection->write(("init " + hashString + "\n").toUtf8());
-    m_connection->write(QString("(%1) hdata buffer:gui_buffers(*) number,name,short_name,hidden,title,local_variables\n").arg(MessageNames::c_requestBuffers).toUtf8());
-    m_connection->write(QString("(%1) hdata buffer:gui_buffers(*)/lines/last_line(-1)/data\n").arg(MessageNames::c_requestFirstLine).toUtf8());
-    m_connection->write(QString("(%1) hdata hotlist:gui_hotlist(*)\n").arg(MessageNames::c_requestHotlist).toUtf8());
-    m_connection->write("sync\n");
-    m_connection->write(QString("(%1) nicklist\n").arg(MessageNames::c_requestNicklist).toUtf8());
+    // all of these go out in one write
+    m_connection->command() << "init " << hashString;
+    if (m_resyncing) {
+        // the relay can't filter lines by date, the last few of each buffer are compared with what we have
+        m_connection->command() << '(' << MessageNames::c_resyncBuffers << ") hdata buffer:gui_buffers(*) " << RequestCatalogue::bufferKeys();
+        m_connection->command() << '(' << MessageNames::c_resyncLines << ") hdata buffer:gui_buffers(*)/lines/last_line(-" << c_resyncLines << ")/data " << RequestCatalogue::lineKeys();
+        m_connection->command() << '(' << MessageNames::c_resyncHotlist << ") hdata hotlist:gui_hotlist(*) " << RequestCatalogue::hotlistKeys();
+        sendSync();
+        m_connection->command() << '(' << MessageNames::c_resyncNicklist << ") nicklist";
+        return;
+    }
+    m_connection->command() << '(' << MessageNames::c_requestBuffers << ") hdata buffer:gui_buffers(*) " << RequestCatalogue::bufferKeys();
+    m_connection->command() << '(' << MessageNames::c_requestFirstLine << ") hdata buffer:gui_buffers(*)/lines/last_line(-1)/data " << RequestCatalogue::lineKeys();
+    m_connection->command() << '(' << MessageNames::c_requestHotlist << ") hdata hotlist:gui_hotlist(*) " << RequestCatalogue::hotlistKeys();
+    sendSync();
+    m_connection->command() << '(' << MessageNames::c_requestNicklist << ") nicklist";
+}
+
+void Weechat::sendSync() {
+    if (!lith()->settingsGet()->selectiveSyncGet()) {
+        m_connection->command() << "sync";
+        return;
+    }
+    // the buffer list is kept up to date for all of them, the lines only for some
+    m_connection->command() << "sync * buffers,upgrade";
+    for (auto ptr : m_sync.fullySynced())
+        m_connection->command() << "sync " << Command::Hex { ptr } << " buffer,nicklist";
+}
+
+void Weechat::selectBuffer(pointer_t ptr) {
+    auto change = m_sync.select(ptr);
+    // before the handshake, the buffer gets synced together with the rest
+    if (!lith()->settingsGet()->selectiveSyncGet() || !(m_initializationStatus & HANDSHAKE) || !m_connection->isConnected())
+        return;
+    if (change.promoted)
+        promoteBuffer(ptr);
+    if (change.demoted)
+        demoteBuffer(change.demoted);
+}
+
+void Weechat::pinBuffer(pointer_t ptr) {
+    auto promoted = m_sync.pin(ptr);
+    if (!lith()->settingsGet()->selectiveSyncGet() || !(m_initializationStatus & HANDSHAKE) || !m_connection->isConnected())
+        return;
+    if (promoted)
+        promoteBuffer(ptr);
+}
+
+void Weechat::forgetBuffer(pointer_t ptr) {
+    m_sync.remove(ptr);
+}
+
+void Weechat::forgetSyncedBuffers() {
+    m_sync.clear();
+}
+
+void Weechat::promoteBuffer(pointer_t ptr) {
+    m_connection->command() << "sync " << Command::Hex { ptr } << " buffer,nicklist";
+    // whatever was said while the buffer wasn't synced
+    m_connection->command() << '(' << MessageNames::c_syncLines << ") hdata buffer:" << Command::Hex { ptr } << "/lines/last_line(-" << c_resyncLines << ")/data " << RequestCatalogue::lineKeys();
+    m_connection->command() << '(' << MessageNames::c_syncNicklist << ") nicklist " << Command::Hex { ptr };
+}
+
+void Weechat::demoteBuffer(pointer_t ptr) {
+    m_connection->command() << "desync " << Command::Hex { ptr } << " buffer,nicklist";
+}
+
+template <typename Record>
+RecordBatch<Record> Weechat::takeRecords(const RequestRegistry::Reply &reply) {
+    RecordBatch<Record> batch;
+    for (auto &hda : reply.hdata) {
+        auto part = Record::fromHData(hda);
+        batch.items.insert(batch.items.end(), std::make_move_iterator(part.items.begin()), std::make_move_iterator(part.items.end()));
+    }
+    return batch;
+}
+
+template <typename Record, void (Lith::*handler)(RecordBatch<Record> &&)>
+void Weechat::deliverReply(const RequestRegistry::Reply &reply) {
+    if (reply.status != RequestRegistry::REPLIED)
+        return;
+    QMetaObject::invokeMethod(lith(), [lith = lith(), batch = takeRecords<Record>(reply)]() mutable {
+        (lith->*handler)(std::move(batch));
+    }, Qt::QueuedConnection);
 }
 
 void Weechat::requestHotlist() {
     if (m_connection->isConnected()) {
-        auto msg = QString("(handleHotlist;%1) hdata hotlist:gui_hotlist(*)\n").arg(m_messageOrder++);
-        m_connection->write(msg.toUtf8());
+        auto request = m_requests->issue("handleHotlist", c_requestTimeout, "hotlist");
+        m_connection->command().replaceable("hotlist").tagged(request.id) << "(handleHotlist;" << request.id << ") hdata hotlist:gui_hotlist(*) " << RequestCatalogue::hotlistKeys();
+        request.future.then(this, [this](RequestRegistry::Reply reply) {
+            deliverReply<HotListData, &Lith::handleHotlist>(reply);
+        });
     }
 }
 
@@ -190,9 +339,20 @@ void Weechat::onConnected() {
     qCritical() << "Connected!";
 
     m_reconnectTimer->stop();
-    m_reconnectTimer->setInterval(100);
-
-    QTimer::singleShot(0, lith(), &Lith::resetData);
+    m_connectTimeoutTimer->stop();
+    m_pingQueued = false;
+    m_pingSent.invalidate();
+    m_livenessTimer->stop();
+    // the replies to whatever was sent on the previous connection won't come
+    m_requests->abandonAll();
+    m_parser.reset();
+
+    // the buffers stay on the screen while the connection comes back
+    m_resyncing = m_modelValid;
+    if (m_resyncing)
+        QTimer::singleShot(0, lith(), &Lith::beginResync);
+    else
+        QTimer::singleShot(0, lith(), &Lith::resetData);
     lith()->networkErrorStringSet(QString());
 
     lith()->statusSet(Lith::CONNECTED);
@@ -204,7 +364,7 @@ void Weechat::onConnected() {
     }
 
     if (lith()->settingsGet()->handshakeAuthGet()) {
-        m_connection->write(QString("(%1) handshake password_hash_algo=%2,compression=%3\n").arg(MessageNames::c_handshake).arg(hashAlgos).arg(lith()->settingsGet()->connectionCompressionGet() ? "zlib" : "off").toUtf8());
+        m_connection->command() << '(' << MessageNames::c_handshake << ") handshake password_hash_algo=" << hashAlgos << ",compression=" << compressionAlgorithms();
     }
     else {
         StringMap data;
@@ -215,113 +375,417 @@ void Weechat::onConnected() {
     m_hotlistTimer->start();
 }
 
+QString Weechat::compressionAlgorithms() {
+    if (!lith()->settingsGet()->connectionCompressionGet())
+        return "off";
+    // the relay picks the first one it supports, off is the last resort
+    auto supported = SocketHelper::supportedCompression();
+    QStringList algorithms;
+    for (auto &i : lith()->settingsGet()->connectionCompressionOrderGet().split(':', Qt::SkipEmptyParts)) {
+        if (supported.contains(i) && !algorithms.contains(i))
+            algorithms.append(i);
+    }
+    if (algorithms.isEmpty())
+        algorithms.append("zlib");
+    algorithms.append("off");
+    return algorithms.join(':');
+}
+
 void Weechat::onDisconnected() {
     lith()->statusSet(Lith::DISCONNECTED);
 
-    m_fetchBuffer.clear();
-    m_bytesRemaining = 0;
+    m_parser.reset();
     m_hotlistTimer->stop();
+    m_requests->abandonAll();
 
-    m_reconnectTimer->setInterval(m_reconnectTimer->interval() * 2);
-    m_reconnectTimer->start();
+    scheduleReconnect();
+}
+
+void Weechat::scheduleReconnect() {
+    // errors usually come together with a disconnect, that's still just one failed attempt
+    if (m_reconnectTimer->isActive())
+        return;
+    m_connectTimeoutTimer->stop();
+    m_reconnectPolicy.setMaxDelay(lith()->settingsGet()->reconnectMaxDelayGet() * 1000);
+    auto delay = m_reconnectPolicy.nextDelay();
+    qInfo() << "Reconnecting in" << delay << "ms, attempt" << m_reconnectPolicy.attempts();
+    m_reconnectTimer->start(delay);
+    publishReconnectState(delay);
+}
+
+void Weechat::publishReconnectState(int delay) {
+    QMetaObject::invokeMethod(m_lith, [lith = m_lith, attempts = m_reconnectPolicy.attempts(), delay]() {
+        lith->reconnectAttemptSet(attempts);
+        lith->reconnectDelaySet(delay);
+    }, Qt::QueuedConnection);
 }
 
 void Weechat::onDataReceived(const QByteArray &data) {
-    auto dataCopy(data);
-    onMessageReceived(dataCopy);
+    m_lastReceived.start();
+    m_messageBytes += data.size();
+    QElapsedTimer timer;
+    timer.start();
+    m_parser.append(data);
+    processMessage(false);
+    m_messageParseTime += timer.nsecsElapsed();
+}
+
+void Weechat::onMessageFinished() {
+    QElapsedTimer timer;
+    timer.start();
+    processMessage(true);
+    m_messageParseTime += timer.nsecsElapsed();
+    m_connection->stats().parseTime.record(m_messageParseTime / 1000);
+    m_messageParseTime = 0;
+    if (m_messageLines > 0) {
+        m_connection->stats().lineBytes += m_messageBytes;
+        m_connection->stats().lines += m_messageLines;
+    }
+    m_messageBytes = 0;
+    m_messageLines = 0;
+    m_parser.reset();
+    m_messageHandler = nullptr;
+    m_messageHandlerResolved = false;
+    m_messageForRequest = false;
 }
 
 void Weechat::onError(const QString &message) {
     lith()->statusSet(Lith::ERROR);
     lith()->networkErrorStringSet("Connection failed: "+ message);
+    scheduleReconnect();
 }
 
 bool Weechat::input(pointer_t ptr, const QString &data) {
+    if (!m_connection->isConnected())
+        return false;
     // server doesn't reply to input commands directly so no message order here
-    auto line = QString("input 0x%1 %2\n").arg(ptr, 0, 16).arg(data);
-    //qCritical() << "WRITING:" << line;
-    auto message = line.toUtf8();
-    if (message.count() == m_connection->write(line.toUtf8()))
-        return true;
-    return false;
+    // every line is a separate command but a whole paste still goes out in a single write
+    static const QRegularExpression newlines("\n|\r\n|\r");
+    for (auto &line : QStringView(data).split(newlines)) {
+        m_connection->command().urgent() << "input " << Command::Hex { ptr } << ' ' << line;
+    }
+    return true;
 }
 
 void Weechat::fetchLines(pointer_t ptr, int count) {
-    auto line = QString("(handleFetchLines;%1) hdata buffer:0x%2/lines/last_line(-%3)/data\n").arg(m_messageOrder++).arg(ptr, 0, 16).arg(count);
-    //qCritical() << "WRITING:" << line;
-    m_connection->write(line.toUtf8());
-    m_timeoutTimer->start(5000);
+    requestTail(ptr, count).then(this, [this](RequestRegistry::Reply reply) {
+        deliverReply<LineData, &Lith::handleFetchLines>(reply);
+    });
+}
+
+QFuture<RequestRegistry::Reply> Weechat::requestTail(pointer_t ptr, int count) {
+    // asking for more lines of the same buffer again only means the previous request is still stuck in the queue
+    auto request = m_requests->issue("handleFetchLines", c_requestTimeout, "fetchLines:" + QByteArray::number(ptr));
+    m_connection->command().replaceable("fetchLines", ptr).tagged(request.id) << "(handleFetchLines;" << request.id << ") hdata buffer:" << Command::Hex { ptr } << "/lines/last_line(-" << count << ")/data " << RequestCatalogue::lineKeys();
+    return request.future;
+}
+
+void Weechat::fetchLinesBefore(pointer_t ptr, pointer_t line, int count, int held) {
+    // the buffer waits for every page it asks for to be done with, one way or another
+    if (!m_connection->isConnected()) {
+        deliverPage(ptr, line, false, {});
+        return;
+    }
+    if (m_cursorPaging == CURSOR_PAGING_UNSUPPORTED) {
+        requestTail(ptr, held + count).then(this, [this, ptr, line, asked = held + count](RequestRegistry::Reply reply) {
+            auto lines = takeRecords<LineData>(reply);
+            // a tail shorter than asked for reaches all the way back
+            auto historyStart = reply.status == RequestRegistry::REPLIED && int(lines.items.size()) < asked;
+            deliverPage(ptr, line, historyStart, std::move(lines));
+        });
+        return;
+    }
+    // only the lines we don't have yet, newest first like the tail would be
+    // a page asked for while the previous one of the same buffer is still out supersedes it
+    auto request = m_requests->issue(MessageNames::c_fetchPage.toLatin1(), c_requestTimeout, "fetchLines:" + QByteArray::number(ptr));
+    m_connection->command().replaceable("fetchLines", ptr).tagged(request.id) << '(' << MessageNames::c_fetchPage << ';' << request.id << ") hdata line:" << Command::Hex { line } << "/prev_line(-" << count << ")/data " << RequestCatalogue::lineKeys();
+    request.future.then(this, [this, ptr, line, held, asked = held + count](RequestRegistry::Reply reply) {
+        auto lines = takeRecords<LineData>(reply);
+        if (m_cursorPaging == CURSOR_PAGING_UNKNOWN && reply.status == RequestRegistry::REPLIED) {
+            if (!lines.items.empty()) {
+                m_cursorPaging = CURSOR_PAGING_SUPPORTED;
+            }
+            else {
+                // the relay answers a pointer it can't resolve with an empty hdata too, only the tail tells it apart from the start of history
+                confirmHistoryStart(ptr, line, held, asked);
+                return;
+            }
+        }
+        // a lost, superseded or timed out page gets asked for again, only an empty reply means there's nothing older
+        auto historyStart = reply.status == RequestRegistry::REPLIED && lines.items.empty();
+        deliverPage(ptr, line, historyStart, std::move(lines));
+    });
 }
 
-void Weechat::onMessageReceived(QByteArray &data) {
-    //qCritical() << "Message!" << data;
-    QDataStream s(&data, QIODevice::ReadOnly);
+void Weechat::confirmHistoryStart(pointer_t ptr, pointer_t line, int held, int asked) {
+    requestTail(ptr, asked).then(this, [this, ptr, line, held, asked](RequestRegistry::Reply reply) {
+        auto lines = takeRecords<LineData>(reply);
+        if (reply.status != RequestRegistry::REPLIED) {
+            deliverPage(ptr, line, false, {});
+            return;
+        }
+        if (int(lines.items.size()) > held) {
+            qWarning() << "The relay doesn't page from a line pointer, fetching whole tails instead";
+            m_cursorPaging = CURSOR_PAGING_UNSUPPORTED;
+            deliverPage(ptr, line, int(lines.items.size()) < asked, std::move(lines));
+            return;
+        }
+        // nothing older than what the buffer holds, the empty page was right but says nothing about the relay yet
+        deliverPage(ptr, line, true, std::move(lines));
+    });
+}
 
-    Protocol::String id = Protocol::parse<Protocol::String>(s);
+void Weechat::deliverPage(pointer_t ptr, pointer_t cursor, bool historyStart, RecordBatch<LineData> &&lines) {
+    QMetaObject::invokeMethod(lith(), [lith = lith(), ptr, cursor, historyStart, lines = std::move(lines)]() mutable {
+        lith->handleFetchPage(ptr, cursor, historyStart, std::move(lines));
+    }, Qt::QueuedConnection);
+}
+
+void Weechat::onMessageReceived(const QByteArray &data, qsizetype offset) {
+    m_lastReceived.start();
+    m_messageBytes += data.size() - offset;
+    // a whole message at once, goes through the same path as one received in parts
+    m_parser.reset();
+    m_parser.adopt(data, offset);
+    onMessageFinished();
+}
+
+void Weechat::processMessage(bool complete) {
+    // hdata items are handed over in batches as soon as they're parsed, the rest of the message may still be on its way
+    forever {
+        if (!m_parser.parse(complete)) {
+            qCritical() << "Received a malformed message:" << m_parser.id();
+            return;
+        }
+        if (m_parser.hasHeader() && !m_messageHandlerResolved) {
+            m_messageHandlerResolved = true;
+            // replies to registered requests finish their futures, the handlers only get replies past their deadline
+            // a superseded request still gets its reply parsed, it just doesn't go anywhere
+            m_messageForRequest = m_requests->isPending(m_parser.id());
+            if (m_messageForRequest)
+                m_requests->receiving(m_parser.id());
+            m_messageHandler = m_messageForRequest ? nullptr : findHandler(m_parser.id());
+            if (!m_messageForRequest && !m_messageHandler)
+                qWarning() << "Possible unhandled message:" << m_parser.id();
+        }
+        if (!m_parser.isHData() || m_parser.itemsAvailable() == 0)
+            break;
+        dispatchHData(m_parser.takeHData());
+    }
 
-    char type[4] = { 0 };
-    s.readRawData(type, 3);
+    if (!complete)
+        return;
 
-    if (QString(type) == "hda") {
-        Protocol::HData hda = Protocol::parse<Protocol::HData>(s);
+    m_requests->replied(m_parser.id());
 
-        if (c_initializationMap.contains(id)) {
+    auto &type = m_parser.type();
+    if (m_parser.isHData()) {
+        // handlers still get to know about replies without any items
+        if (m_parser.itemsTaken() == 0)
+            dispatchHData(m_parser.takeHData());
+        if (m_messageHandler) {
             // wtf, why can't I write this as |= ?
-            m_initializationStatus = (Initialization) (m_initializationStatus | c_initializationMap.value(id, UNINITIALIZED));
-            if (!QMetaObject::invokeMethod(Lith::instance(), id.toStdString().c_str(), Qt::QueuedConnection, Q_ARG(Protocol::HData, hda))) {
-                qWarning() << "Possible unhandled message:" << id;
+            m_initializationStatus = (Initialization) (m_initializationStatus | m_messageHandler->initialization);
+            if (m_initializationStatus == COMPLETE && m_connectStarted.isValid()) {
+                m_connection->stats().connectTime = m_connectStarted.nsecsElapsed() / 1000;
+                qInfo() << "Connected and initialized in" << m_connection->stats().connectTime / 1000 << "ms";
+                m_connectStarted.invalidate();
             }
-        }
-        else {
-            auto name = id.split(";").first();
-            if (!QMetaObject::invokeMethod(Lith::instance(), name.toStdString().c_str(), Qt::QueuedConnection, Q_ARG(Protocol::HData, hda))) {
-                qWarning() << "Possible unhandled message:" << name;
+            if (m_initializationStatus == COMPLETE) {
+                if (m_resyncing)
+                    QTimer::singleShot(0, lith(), &Lith::endResync);
+                m_resyncing = false;
+                m_modelValid = true;
+            }
+            // only a connection that got all the way through the initialization counts as working again
+            if (m_initializationStatus == COMPLETE && m_reconnectPolicy.attempts() > 0) {
+                m_reconnectPolicy.reset();
+                publishReconnectState(0);
             }
         }
     }
-    else if (QString(type) == "htb") {
+    else if (type == "htb") {
+        auto s = m_parser.payload();
         Protocol::HashTable htb = Protocol::parse<Protocol::HashTable>(s);
+        if (!s.atEnd())
+            qCritical() << "STREAM WAS NOT AT END!!!";
 
-        onHandshakeAccepted(htb);
+        if (m_messageHandler && m_messageHandler->hashTable)
+            (this->*m_messageHandler->hashTable)(htb);
+        return;
     }
-    else if (QString(type) == "str") {
+    else if (type == "str") {
+        auto s = m_parser.payload();
         Protocol::String str = Protocol::parse<Protocol::String>(s);
+        if (!s.atEnd())
+            qCritical() << "STREAM WAS NOT AT END!!!";
 
-        if (!QMetaObject::invokeMethod(Lith::instance(), id.toStdString().c_str(), Qt::QueuedConnection, Q_ARG(const FormattedString&, str))) {
-            qWarning() << "Possible unhandled message:" << id;
-        }
+        if (m_messageHandler && m_messageHandler->string)
+            m_messageHandler->string(lith(), str);
+        if (m_messageHandler && m_messageHandler->weechatString)
+            (this->*m_messageHandler->weechatString)(str);
+        return;
     }
     else {
         qCritical() << "onMessageReceived is not handling type: " << type;
+        return;
     }
 
-    if (!s.atEnd()) {
+    if (!m_parser.atEnd()) {
         qCritical() << "STREAM WAS NOT AT END!!!";
     }
 }
 
-void Weechat::onPongReceived(qint64 id) {
-    m_lastReceivedPong = id;
+void Weechat::dispatchHData(Protocol::HData &&hda) {
+    if (!hda.path.isEmpty() && hda.path.last() == "line_data")
+        m_messageLines += hda.count;
+    if (m_messageForRequest)
+        m_requests->collect(m_parser.id(), std::move(hda));
+    else if (m_messageHandler && m_messageHandler->hdata)
+        m_messageHandler->hdata(lith(), hda);
 }
 
-void Weechat::onTimeout() {
-    m_connection->reset();
-    lith()->statusSet(Lith::DISCONNECTED);
-    start();
+namespace {
+// Records are built on this thread and moved into the queued call, the GUI thread gets them without any copies
+template <typename Record, void (Lith::*handler)(RecordBatch<Record> &&)>
+void deliverRecords(Lith *lith, const Protocol::HData &hda) {
+    QMetaObject::invokeMethod(lith, [lith, batch = Record::fromHData(hda)]() mutable {
+        (lith->*handler)(std::move(batch));
+    }, Qt::QueuedConnection);
 }
 
-void Weechat::onPingTimeout() {
-    static qint64 previousPing = 0;
-    if (m_initializationStatus == COMPLETE) {
-        if (previousPing < m_lastReceivedPong - 1) {
-            restart();
-        }
-        previousPing = m_messageOrder++;
-        if (m_connection->write(QString("(%1) ping %1\n").arg(previousPing)) <= 0) {
+template <void (Lith::*handler)(const Protocol::HData &)>
+void deliverHData(Lith *lith, const Protocol::HData &hda) {
+    QMetaObject::invokeMethod(lith, [lith, hda]() {
+        (lith->*handler)(hda);
+    }, Qt::QueuedConnection);
+}
+}
+
+const Weechat::MessageHandler *Weechat::findHandler(QByteArrayView id) {
+    static const MessageHandler c_handlers[] {
+        // events sent because of sync, the most frequent ones first
+        { "_buffer_line_added", UNINITIALIZED, &deliverRecords<LineData, &Lith::_buffer_line_added>, nullptr, nullptr },
+        { "_nicklist_diff", UNINITIALIZED, &deliverRecords<NickData, &Lith::_nicklist_diff>, nullptr, nullptr },
+        { "_pong", UNINITIALIZED, nullptr, nullptr, nullptr, &Weechat::onPong },
+        { "_nicklist", UNINITIALIZED, &deliverRecords<NickData, &Lith::_nicklist>, nullptr, nullptr },
+        { "_buffer_opened", UNINITIALIZED, &deliverHData<&Lith::_buffer_opened>, nullptr, nullptr },
+        { "_buffer_type_changed", UNINITIALIZED, &deliverHData<&Lith::_buffer_type_changed>, nullptr, nullptr },
+        { "_buffer_moved", UNINITIALIZED, &deliverHData<&Lith::_buffer_moved>, nullptr, nullptr },
+        { "_buffer_merged", UNINITIALIZED, &deliverHData<&Lith::_buffer_merged>, nullptr, nullptr },
+        { "_buffer_unmerged", UNINITIALIZED, &deliverHData<&Lith::_buffer_unmerged>, nullptr, nullptr },
+        { "_buffer_hidden", UNINITIALIZED, &deliverHData<&Lith::_buffer_hidden>, nullptr, nullptr },
+        { "_buffer_unhidden", UNINITIALIZED, &deliverHData<&Lith::_buffer_unhidden>, nullptr, nullptr },
+        { "_buffer_renamed", UNINITIALIZED, &deliverHData<&Lith::_buffer_renamed>, nullptr, nullptr },
+        { "_buffer_title_changed", UNINITIALIZED, &deliverHData<&Lith::_buffer_title_changed>, nullptr, nullptr },
+        { "_buffer_localvar_added", UNINITIALIZED, &deliverHData<&Lith::_buffer_localvar_added>, nullptr, nullptr },
+        { "_buffer_localvar_changed", UNINITIALIZED, &deliverHData<&Lith::_buffer_localvar_changed>, nullptr, nullptr },
+        { "_buffer_localvar_removed", UNINITIALIZED, &deliverHData<&Lith::_buffer_localvar_removed>, nullptr, nullptr },
+        { "_buffer_closing", UNINITIALIZED, &deliverHData<&Lith::_buffer_closing>, nullptr, nullptr },
+        { "_buffer_cleared", UNINITIALIZED, &deliverHData<&Lith::_buffer_cleared>, nullptr, nullptr },
+        // replies to our own requests, these only see the ones that came after their deadline
+        { "handleHotlist", UNINITIALIZED, &deliverRecords<HotListData, &Lith::handleHotlist>, nullptr, nullptr },
+        { "handleFetchLines", UNINITIALIZED, &deliverRecords<LineData, &Lith::handleFetchLines>, nullptr, nullptr },
+        { "handleFetchPage", UNINITIALIZED, &deliverRecords<LineData, &Lith::handleFetchLines>, nullptr, nullptr },
+        { "handleHandshake", UNINITIALIZED, nullptr, nullptr, &Weechat::onHandshakeAccepted },
+        { "handleBufferInitialization", REQUEST_BUFFERS, &deliverHData<&Lith::handleBufferInitialization>, nullptr, nullptr },
+        { "handleFirstReceivedLine", REQUEST_FIRST_LINE, &deliverRecords<LineData, &Lith::handleFirstReceivedLine>, nullptr, nullptr },
+        { "handleHotlistInitialization", REQUEST_HOTLIST, &deliverRecords<HotListData, &Lith::handleHotlistInitialization>, nullptr, nullptr },
+        { "handleNicklistInitialization", REQUEST_NICKLIST, &deliverRecords<NickData, &Lith::handleNicklistInitialization>, nullptr, nullptr },
+        { "handleBufferResync", REQUEST_BUFFERS, &deliverHData<&Lith::handleBufferResync>, nullptr, nullptr },
+        { "handleLinesResync", REQUEST_FIRST_LINE, &deliverRecords<LineData, &Lith::handleLinesResync>, nullptr, nullptr },
+        { "handleHotlistResync", REQUEST_HOTLIST, &deliverRecords<HotListData, &Lith::handleHotlistResync>, nullptr, nullptr },
+        { "handleNicklistResync", REQUEST_NICKLIST, &deliverRecords<NickData, &Lith::handleNicklistResync>, nullptr, nullptr },
+        { "handleBufferLinesSync", UNINITIALIZED, &deliverRecords<LineData, &Lith::handleLinesResync>, nullptr, nullptr },
+        { "handleBufferNicklistSync", UNINITIALIZED, &deliverRecords<NickData, &Lith::_nicklist>, nullptr, nullptr },
+    };
+
+    auto separator = static_cast<const char*>(std::memchr(id.data(), ';', id.size()));
+    auto name = separator ? id.first(separator - id.data()) : id;
+    for (auto &i : c_handlers) {
+        if (i.name.size() == name.size() && std::memcmp(i.name.data(), name.data(), name.size()) == 0)
+            return &i;
+    }
+    return nullptr;
+}
+
+void Weechat::onPong(const FormattedString &str) {
+    // handled right here, a busy GUI thread would make the connection look slow
+    auto id = str.toLongLong();
+    if (id == m_pingSentId && m_pingSent.isValid()) {
+        auto &stats = m_connection->stats();
+        stats.lastPingLatency = m_pingSent.nsecsElapsed() / 1000;
+        stats.pingLatency.record(stats.lastPingLatency);
+        m_rtt.addSample(stats.lastPingLatency / 1000);
+        m_pingSent.invalidate();
+        m_livenessTimer->stop();
+    }
+}
+
+void Weechat::publishMetrics() {
+    auto snapshot = ConnectionMetrics::Snapshot::fromStats(m_connection->stats(), m_lastMetrics, m_metricsElapsed.restart());
+    m_lastMetrics = snapshot;
+    QMetaObject::invokeMethod(lith()->metricsGet(), [metrics = lith()->metricsGet(), snapshot]() {
+        metrics->update(snapshot);
+    }, Qt::QueuedConnection);
+}
+
+void Weechat::onApplicationStateChanged(Qt::ApplicationState state) {
+    if (state != Qt::ApplicationActive || !lith()->settingsGet()->connectionWarmUpGet())
+        return;
+    if (lith()->settingsGet()->hostGet().isEmpty() || lith()->settingsGet()->passphraseGet().isEmpty())
+        return;
+    if (!m_connection->isConnected()) {
+        // the user is looking, don't make them wait for the backoff
+        if (m_reconnectTimer->isActive()) {
+            m_reconnectPolicy.reset();
+            publishReconnectState(0);
+            lith()->statusSet(Lith::CONNECTING);
             restart();
         }
+        return;
     }
-    else {
-        //restart();
+#ifndef Q_OS_WASM
+    m_connection->warmUp(lith()->settingsGet()->hostGet());
+#endif // Q_OS_WASM
+    // the connection may have died while in the background, find out now rather than at the next ping
+    onPingTimeout();
+}
+
+void Weechat::onPingTimeout() {
+    if (m_initializationStatus != COMPLETE)
+        return;
+    if (!m_connection->isConnected()) {
+        restart();
+        return;
+    }
+    // the previous ping is still queued or waiting for its reply, the liveness timer takes care of that one
+    if (m_pingQueued || m_pingSent.isValid())
+        return;
+    m_pingSentId = m_messageOrder++;
+    m_pingQueued = true;
+    m_connection->command().urgent().tagged(c_pingTag) << '(' << m_pingSentId << ") ping " << m_pingSentId;
+}
+
+void Weechat::onPingWritten() {
+    if (!m_pingQueued)
+        return;
+    m_pingQueued = false;
+    m_pingSent.start();
+    m_livenessTimer->start(m_rtt.deadTimeout());
+}
+
+void Weechat::onLivenessTimeout() {
+    // a reply can be stuck behind a large message, anything arriving means the connection is alive
+    // the timeout doesn't change while the ping is out, the estimator only learns from the pong
+    auto deadTimeout = m_rtt.deadTimeout();
+    auto sinceReceived = m_lastReceived.isValid() ? m_lastReceived.elapsed() : deadTimeout;
+    if (sinceReceived < deadTimeout) {
+        m_livenessTimer->start(int(deadTimeout - sinceReceived));
+        return;
     }
+    qWarning() << "No reply to ping in" << m_pingSent.elapsed() << "ms (smoothed RTT" << m_rtt.smoothed() << "ms), the connection seems to be dead";
+    m_pingSent.invalidate();
+    lith()->statusSet(Lith::CONNECTING);
+    restart();
 }
@@ -18,14 +18,22 @@
 #define WEECHAT_H
 
 #include "common.h"
+#include "protocol.h"
 #include "settings.h"
+#include "util/reconnectpolicy.h"
+#include "util/requestcatalogue.h"
+#include "util/requestregistry.h"
+#include "util/rttestimator.h"
 #include "util/sockethelper.h"
+#include "util/syncmanager.h"
 
+#include <QElapsedTimer>
 #include <QSslSocket>
-#include <QDataStream>
 #include <QTimer>
 
 class Lith;
+template <typename T> struct RecordBatch;
+struct LineData;
 
 class Weechat : public QObject {
 public:
@@ -37,6 +45,9 @@ public:
     static QByteArray hashPassword(const QString &password, const QString &algo, const QByteArray &salt, int iterations);
     static QByteArray randomString(int length);
 
+    // lines asked for per buffer when resyncing, if all of them are new the older ones are dropped
+    static constexpr int c_resyncLines { 25 };
+
 public slots:
     void init();
 
@@ -45,33 +56,76 @@ public slots:
 
     bool input(pointer_t ptr, const QString &data);
     void fetchLines(pointer_t ptr, int count);
+    // count lines older than the line, held is how many the buffer has in case the relay can't do that
+    void fetchLinesBefore(pointer_t ptr, pointer_t line, int count, int held);
+    // with selective sync, these decide what the relay keeps pushing
+    void selectBuffer(pointer_t ptr);
+    void pinBuffer(pointer_t ptr);
+    void forgetBuffer(pointer_t ptr);
+    // the relay was restarted, none of the pointers it was asked to sync mean anything now
+    void forgetSyncedBuffers();
 
 private slots:
 
-    void onMessageReceived(QByteArray &data);
-    void onPongReceived(qint64 id);
+    void onMessageReceived(const QByteArray &data, qsizetype offset = 0);
 
     void requestHotlist();
-    void onTimeout();
     void onPingTimeout();
+    void onLivenessTimeout();
+    void onPingWritten();
+    void scheduleReconnect();
+    void publishMetrics();
+    void onApplicationStateChanged(Qt::ApplicationState state);
 
     void onConnectionSettingsChanged();
     
     void onHandshakeAccepted(const StringMap &data);
+    void onPong(const FormattedString &str);
 
     void onConnected();
     void onDisconnected();
     void onDataReceived(const QByteArray &data);
+    void onMessageFinished();
     void onError(const QString &message);
 
 private:
+    // the compression option of the handshake, in the order of preference from the settings
+    QString compressionAlgorithms();
+    // plays back a trace recorded with LITH_TRACE_RECORD instead of connecting to the relay
+    void startReplay(const QString &path);
+    void processMessage(bool complete);
+    void publishReconnectState(int delay);
+    void sendSync();
+    void promoteBuffer(pointer_t ptr);
+    void demoteBuffer(pointer_t ptr);
+    void dispatchHData(Protocol::HData &&hda);
+    // the records of a whole reply to a registered request, passed on like the parts of any other message
+    template <typename Record, void (Lith::*handler)(RecordBatch<Record> &&)>
+    void deliverReply(const RequestRegistry::Reply &reply);
+    template <typename Record>
+    static RecordBatch<Record> takeRecords(const RequestRegistry::Reply &reply);
+    QFuture<RequestRegistry::Reply> requestTail(pointer_t ptr, int count);
+    // the lines of a page go in before the buffer hears the page is done
+    void deliverPage(pointer_t ptr, pointer_t cursor, bool historyStart, RecordBatch<LineData> &&lines);
+    // an empty page while it's not known yet whether the relay pages from a line pointer
+    void confirmHistoryStart(pointer_t ptr, pointer_t line, int held, int asked);
+
     struct MessageNames {
-        // these names actually correspond to slot names in Lith
+        // ids of the requests sent during initialization, findHandler resolves them like any other id
         inline static const QString c_handshake { "handleHandshake" };
         inline static const QString c_requestBuffers { "handleBufferInitialization" };
         inline static const QString c_requestFirstLine { "handleFirstReceivedLine" };
         inline static const QString c_requestHotlist { "handleHotlistInitialization" };
         inline static const QString c_requestNicklist { "handleNicklistInitialization" };
+        // the same requests after a reconnection, reconciled with the model that was kept
+        inline static const QString c_resyncBuffers { "handleBufferResync" };
+        inline static const QString c_resyncLines { "handleLinesResync" };
+        inline static const QString c_resyncHotlist { "handleHotlistResync" };
+        inline static const QString c_resyncNicklist { "handleNicklistResync" };
+        // a buffer that gets fully synced again catches up with these
+        inline static const QString c_syncLines { "handleBufferLinesSync" };
+        inline static const QString c_syncNicklist { "handleBufferNicklistSync" };
+        inline static const QString c_fetchPage { "handleFetchPage" };
     };
     enum Initialization {
         UNINITIALIZED = 0,
@@ -82,27 +136,74 @@ private:
         REQUEST_NICKLIST = 1 << 4,
         COMPLETE = HANDSHAKE | REQUEST_BUFFERS | REQUEST_FIRST_LINE | REQUEST_HOTLIST | REQUEST_NICKLIST
     } m_initializationStatus { UNINITIALIZED };
-    inline static const QMap<QString, Initialization> c_initializationMap {
-        { MessageNames::c_handshake, HANDSHAKE },
-        { MessageNames::c_requestBuffers, REQUEST_BUFFERS },
-        { MessageNames::c_requestFirstLine, REQUEST_FIRST_LINE },
-        { MessageNames::c_requestHotlist, REQUEST_HOTLIST },
-        { MessageNames::c_requestNicklist, REQUEST_NICKLIST }
+
+    // What a message id resolves to, looked up once per message from a static table
+    // Handlers for records run on this thread and only pass finished batches on to Lith
+    struct MessageHandler {
+        QByteArrayView name;
+        Initialization initialization;
+        void (*hdata)(Lith *lith, const Protocol::HData &hda);
+        void (*string)(Lith *lith, const FormattedString &str);
+        void (Weechat::*hashTable)(const StringMap &data);
+        // strings handled on this thread
+        void (Weechat::*weechatString)(const FormattedString &str) { nullptr };
     };
+    // the request sequence number after a semicolon isn't a part of the name
+    static const MessageHandler *findHandler(QByteArrayView id);
 
     SocketHelper *m_connection;
+    Protocol::MessageParser m_parser;
+    const MessageHandler *m_messageHandler { nullptr };
+    bool m_messageHandlerResolved { false };
+    // the message is a reply a registered request is waiting for, its parts go to the registry
+    bool m_messageForRequest { false };
     bool m_restarting { false };
-
-    QByteArray m_fetchBuffer;
-    qint32 m_bytesRemaining { 0 };
+    // set once the model holds everything from the current relay, a reconnection then only resyncs it
+    bool m_modelValid { false };
+    bool m_resyncing { false };
 
     QTimer *m_hotlistTimer { new QTimer(this) };
-    QTimer *m_timeoutTimer { new QTimer(this) };
     QTimer *m_pingTimer { new QTimer(this) };
     QTimer *m_reconnectTimer { new QTimer(this) };
-
+    QTimer *m_connectTimeoutTimer { new QTimer(this) };
+    static constexpr int c_connectTimeout { 15000 };
+    ReconnectPolicy m_reconnectPolicy;
+    QTimer *m_metricsTimer { new QTimer(this) };
+    // runs while a ping waits for its reply
+    QTimer *m_livenessTimer { new QTimer(this) };
+
+    // requests that expect a reply with their id, and how long they may wait for it
+    RequestRegistry *m_requests { new RequestRegistry(this) };
+    static constexpr int c_requestTimeout { 10000 };
+    // ping ids, the pongs come as events
     qint64 m_messageOrder { 0 };
-    qint64 m_lastReceivedPong { 0 };
+    qint64 m_pingSentId { -1 };
+    // only one ping is out at a time, the request ids are all positive
+    static constexpr qint64 c_pingTag { -1 };
+    // waiting behind other commands, the wait for the reply starts once it's written
+    bool m_pingQueued { false };
+    QElapsedTimer m_pingSent;
+    QElapsedTimer m_lastReceived;
+    RttEstimator m_rtt;
+    SyncManager m_sync;
+    // from the start of the connection attempt until the initialization completes
+    QElapsedTimer m_connectStarted;
+
+    // nanoseconds spent parsing the message being received so far
+    qint64 m_messageParseTime { 0 };
+    // size and line count of the message being received, for the bytes per line
+    qint64 m_messageBytes { 0 };
+    qint64 m_messageLines { 0 };
+
+    // relays that can't resolve a line pointer reply with an empty hdata, the first empty page is checked against the tail
+    // and once that turns out longer than what the buffer holds, the whole tail is fetched instead
+    enum CursorPaging {
+        CURSOR_PAGING_UNKNOWN,
+        CURSOR_PAGING_SUPPORTED,
+        CURSOR_PAGING_UNSUPPORTED,
+    } m_cursorPaging { CURSOR_PAGING_UNKNOWN };
+    QElapsedTimer m_metricsElapsed;
+    ConnectionMetrics::Snapshot m_lastMetrics;
 
     Lith *m_lith;
 };
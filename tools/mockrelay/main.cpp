@@ -0,0 +1,72 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#include "relayserver.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("lith-mockrelay");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Pretends to be a WeeChat relay so Lith can be tested and load tested without one");
+    parser.addHelpOption();
+
+    QCommandLineOption portOption("port", "TCP port, 0 disables plain TCP", "port", "9001");
+    QCommandLineOption webSocketPortOption("websocket-port", "WebSocket port, 0 disables WebSockets", "port", "9002");
+    QCommandLineOption tlsPortOption("tls-port", "TLS port, 0 disables TLS, needs --tls-certificate and --tls-key", "port", "0");
+    QCommandLineOption tlsCertificateOption("tls-certificate", "PEM certificate for the TLS port", "file");
+    QCommandLineOption tlsKeyOption("tls-key", "PEM private key of the certificate", "file");
+    QCommandLineOption passwordOption("password", "Relay password", "password", "test");
+    QCommandLineOption iterationsOption("iterations", "PBKDF2 iterations offered in the handshake", "count", "1000");
+    QCommandLineOption noCompressionOption("no-compression", "Never compress messages");
+    QCommandLineOption buffersOption("buffers", "Number of buffers", "count", "20");
+    QCommandLineOption nicksOption("nicks", "Nicks in each channel", "count", "50");
+    QCommandLineOption historyOption("history", "Lines already in each buffer, use a lot of them for huge history replies", "count", "200");
+    QCommandLineOption linesOption("lines-per-second", "New lines over all buffers, sent as _buffer_line_added", "rate", "1");
+    QCommandLineOption netsplitIntervalOption("netsplit-interval", "Seconds between netsplits sent as _nicklist_diff, 0 disables them", "seconds", "0");
+    QCommandLineOption netsplitSizeOption("netsplit-size", "Nicks leaving a channel in a netsplit", "count", "20");
+    QCommandLineOption seedOption("seed", "Seed for the generated content", "seed", "1");
+    QCommandLineOption latencyOption("latency", "Milliseconds every message is delayed by before it is sent", "ms", "0");
+    parser.addOptions({ portOption, webSocketPortOption, tlsPortOption, tlsCertificateOption, tlsKeyOption, passwordOption, iterationsOption, noCompressionOption, latencyOption,
+                        buffersOption, nicksOption, historyOption, linesOption, netsplitIntervalOption, netsplitSizeOption, seedOption });
+    parser.process(app);
+
+    RelayOptions options;
+    options.password = parser.value(passwordOption).toUtf8();
+    options.iterations = parser.value(iterationsOption).toInt();
+    options.compression = !parser.isSet(noCompressionOption);
+    options.latency = parser.value(latencyOption).toInt();
+    options.tlsCertificate = parser.value(tlsCertificateOption);
+    options.tlsKey = parser.value(tlsKeyOption);
+
+    ScenarioOptions scenario;
+    scenario.buffers = parser.value(buffersOption).toInt();
+    scenario.nicksPerChannel = parser.value(nicksOption).toInt();
+    scenario.historyLines = parser.value(historyOption).toInt();
+    scenario.linesPerSecond = parser.value(linesOption).toDouble();
+    scenario.netsplitInterval = parser.value(netsplitIntervalOption).toInt();
+    scenario.netsplitSize = parser.value(netsplitSizeOption).toInt();
+    scenario.seed = parser.value(seedOption).toUInt();
+
+    RelayServer server(options, scenario);
+    if (!server.listen(parser.value(portOption).toUShort(), parser.value(webSocketPortOption).toUShort(), parser.value(tlsPortOption).toUShort()))
+        return 1;
+
+    return app.exec();
+}
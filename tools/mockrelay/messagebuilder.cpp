@@ -0,0 +1,136 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#include "messagebuilder.h"
+
+#include <QtEndian>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif // HAVE_ZSTD
+
+// WeeChat doesn't bother compressing tiny messages either
+static constexpr qsizetype c_compressionThreshold { 64 };
+#ifdef HAVE_ZSTD
+// fast enough to keep up with load tests, still much smaller than zlib
+static constexpr int c_zstdLevel { 3 };
+#endif // HAVE_ZSTD
+
+MessageBuilder::MessageBuilder(QByteArrayView id) {
+    addString(id);
+}
+
+void MessageBuilder::addType(const char *type) {
+    m_data.append(type, 3);
+}
+
+void MessageBuilder::addChar(char value) {
+    m_data.append(value);
+}
+
+void MessageBuilder::addInt(qint32 value) {
+    char buffer[4];
+    qToBigEndian<qint32>(value, buffer);
+    m_data.append(buffer, 4);
+}
+
+void MessageBuilder::addLong(qint64 value) {
+    auto digits = QByteArray::number(value);
+    m_data.append(char(digits.size()));
+    m_data.append(digits);
+}
+
+void MessageBuilder::addString(QByteArrayView value) {
+    addInt(qint32(value.size()));
+    m_data.append(value);
+}
+
+void MessageBuilder::addNullString() {
+    addInt(-1);
+}
+
+void MessageBuilder::addPointer(quint64 value) {
+    auto digits = QByteArray::number(value, 16);
+    m_data.append(char(digits.size()));
+    m_data.append(digits);
+}
+
+void MessageBuilder::addTime(qint64 value) {
+    addLong(value);
+}
+
+qsizetype MessageBuilder::addHDataHeader(QByteArrayView path, QByteArrayView keys, qint32 count) {
+    addType("hda");
+    addString(path);
+    addString(keys);
+    auto position = m_data.size();
+    addInt(count);
+    return position;
+}
+
+void MessageBuilder::addHashTableHeader(const char *keyType, const char *valueType, qint32 count) {
+    addType("htb");
+    addType(keyType);
+    addType(valueType);
+    addInt(count);
+}
+
+void MessageBuilder::addArrayHeader(const char *type, qint32 count) {
+    addType(type);
+    addInt(count);
+}
+
+void MessageBuilder::setInt(qsizetype position, qint32 value) {
+    qToBigEndian<qint32>(value, m_data.data() + position);
+}
+
+QByteArray MessageBuilder::frame(Compression compression) const {
+    QByteArray payload;
+    if (m_data.size() < c_compressionThreshold)
+        compression = NoCompression;
+    switch (compression) {
+    case ZlibCompression:
+        // qCompress puts the uncompressed length in front of the zlib stream, the protocol doesn't have it
+        payload = qCompress(m_data).mid(4);
+        break;
+#ifdef HAVE_ZSTD
+    case ZstdCompression: {
+        payload.resize(qsizetype(ZSTD_compressBound(size_t(m_data.size()))));
+        auto size = ZSTD_compress(payload.data(), size_t(payload.size()), m_data.constData(), size_t(m_data.size()), c_zstdLevel);
+        if (ZSTD_isError(size)) {
+            payload = m_data;
+            compression = NoCompression;
+            break;
+        }
+        payload.resize(qsizetype(size));
+        break;
+    }
+#endif // HAVE_ZSTD
+    default:
+        payload = m_data;
+        compression = NoCompression;
+        break;
+    }
+
+    QByteArray result;
+    result.reserve(payload.size() + 5);
+    char header[5];
+    qToBigEndian<qint32>(qint32(payload.size() + 5), header);
+    header[4] = char(compression);
+    result.append(header, 5);
+    result.append(payload);
+    return result;
+}
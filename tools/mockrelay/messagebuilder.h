@@ -0,0 +1,59 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MESSAGEBUILDER_H
+#define MESSAGEBUILDER_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+
+// Serializes objects of the WeeChat relay binary protocol
+// https://weechat.org/files/doc/stable/weechat_relay_protocol.en.html#objects
+class MessageBuilder {
+public:
+    // the values are what the frame header says
+    enum Compression {
+        NoCompression = 0,
+        ZlibCompression = 1,
+        ZstdCompression = 2,
+    };
+
+    // the id is the one the client sent in parentheses or the name of the event
+    explicit MessageBuilder(QByteArrayView id);
+
+    void addType(const char *type);
+    void addChar(char value);
+    void addInt(qint32 value);
+    void addLong(qint64 value);
+    void addString(QByteArrayView value);
+    void addNullString();
+    void addPointer(quint64 value);
+    void addTime(qint64 value);
+
+    // the count of hdata items isn't always known in advance, the returned position can be patched with setInt
+    qsizetype addHDataHeader(QByteArrayView path, QByteArrayView keys, qint32 count = 0);
+    void addHashTableHeader(const char *keyType, const char *valueType, qint32 count);
+    void addArrayHeader(const char *type, qint32 count);
+    void setInt(qsizetype position, qint32 value);
+
+    // the whole frame including the length and compression header
+    QByteArray frame(Compression compression) const;
+
+private:
+    QByteArray m_data;
+};
+
+#endif // MESSAGEBUILDER_H
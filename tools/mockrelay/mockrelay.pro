@@ -0,0 +1,34 @@
+# Mock WeeChat relay for testing and load testing Lith without a real WeeChat
+# Build it separately: qmake tools/mockrelay && make
+
+QT = core network websockets
+
+!versionAtLeast(QT_VERSION, 6.2.0) {
+    message("Cannot use Qt $${QT_VERSION}")
+    error("Use Qt 6.2 or newer")
+}
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+# zstd is offered in the handshake only when it's available, zlib always is
+packagesExist(libzstd) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libzstd
+    DEFINES += HAVE_ZSTD
+}
+
+TARGET = lith-mockrelay
+
+HEADERS += \
+    messagebuilder.h \
+    relayclient.h \
+    relayserver.h \
+    scenario.h
+
+SOURCES += \
+    main.cpp \
+    messagebuilder.cpp \
+    relayclient.cpp \
+    relayserver.cpp \
+    scenario.cpp
@@ -0,0 +1,474 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#include "relayclient.h"
+#include "relayserver.h"
+#include "messagebuilder.h"
+
+#include <QTcpSocket>
+#include <QWebSocket>
+#include <QCryptographicHash>
+#include <QPasswordDigestor>
+#include <QRandomGenerator>
+#include <QRegularExpression>
+#include <QTimer>
+#include <QDebug>
+
+// strongest first, the first one the client supports is picked
+static const QByteArrayList c_hashAlgorithms { "pbkdf2+sha512", "pbkdf2+sha256", "sha512", "sha256", "plain" };
+// indexed by MessageBuilder::Compression
+static const char *c_compressionNames[] { "off", "zlib", "zstd" };
+
+RelayClient::RelayClient(RelayServer *server, QTcpSocket *socket)
+    : QObject(server)
+    , m_server(server)
+    , m_tcpSocket(socket)
+{
+    socket->setParent(this);
+    connect(socket, &QTcpSocket::readyRead, this, &RelayClient::onReadyRead);
+    connect(socket, &QTcpSocket::disconnected, this, &RelayClient::closed);
+}
+
+RelayClient::RelayClient(RelayServer *server, QWebSocket *socket)
+    : QObject(server)
+    , m_server(server)
+    , m_webSocket(socket)
+{
+    socket->setParent(this);
+    connect(socket, &QWebSocket::textMessageReceived, this, &RelayClient::onTextMessageReceived);
+    connect(socket, &QWebSocket::binaryMessageReceived, this, [this](const QByteArray &message) {
+        onTextMessageReceived(QString::fromUtf8(message));
+    });
+    connect(socket, &QWebSocket::disconnected, this, &RelayClient::closed);
+}
+
+bool RelayClient::isSynced(quint64 buffer, SyncFlag flag) const {
+    return (m_syncAll & flag) || (m_syncBuffers.value(buffer) & flag);
+}
+
+void RelayClient::send(const MessageBuilder &message) {
+    sendFrame(message.frame(m_compression));
+}
+
+void RelayClient::sendFrame(const QByteArray &frame) {
+    auto latency = m_server->options().latency;
+    if (latency > 0) {
+        // timers with the same interval fire in the order they were started, the frames stay in order
+        QTimer::singleShot(latency, this, [this, frame]() {
+            if (m_tcpSocket)
+                m_tcpSocket->write(frame);
+            if (m_webSocket)
+                m_webSocket->sendBinaryMessage(frame);
+        });
+        return;
+    }
+    if (m_tcpSocket)
+        m_tcpSocket->write(frame);
+    if (m_webSocket)
+        m_webSocket->sendBinaryMessage(frame);
+}
+
+void RelayClient::onReadyRead() {
+    m_input.append(m_tcpSocket->readAll());
+    qsizetype newline;
+    while ((newline = m_input.indexOf('\n')) >= 0) {
+        auto line = m_input.left(newline);
+        m_input.remove(0, newline + 1);
+        handleLine(line);
+        if (!m_tcpSocket)
+            return;
+    }
+}
+
+void RelayClient::onTextMessageReceived(const QString &message) {
+    // a single message can carry more commands
+    for (auto &line : message.toUtf8().split('\n')) {
+        if (!line.isEmpty())
+            handleLine(line);
+        if (!m_webSocket)
+            return;
+    }
+}
+
+void RelayClient::close() {
+    if (m_tcpSocket) {
+        m_tcpSocket->disconnectFromHost();
+        m_tcpSocket = nullptr;
+    }
+    if (m_webSocket) {
+        m_webSocket->close();
+        m_webSocket = nullptr;
+    }
+    emit closed();
+}
+
+void RelayClient::handleLine(QByteArray line) {
+    if (line.endsWith('\r'))
+        line.chop(1);
+    if (line.isEmpty())
+        return;
+
+    // (id) command arguments
+    QByteArray id;
+    if (line.startsWith('(')) {
+        auto end = line.indexOf(')');
+        if (end < 0)
+            return;
+        id = line.mid(1, end - 1);
+        line = line.mid(end + 1).trimmed();
+    }
+    auto space = line.indexOf(' ');
+    auto command = space < 0 ? line : line.left(space);
+    auto arguments = space < 0 ? QByteArray() : line.mid(space + 1);
+
+    if (command == "handshake") {
+        handshake(id, arguments);
+        return;
+    }
+    if (command == "init") {
+        init(arguments);
+        return;
+    }
+    if (!m_authenticated) {
+        // WeeChat drops clients that try anything before authenticating
+        qWarning() << "Command" << command << "before authentication, closing";
+        close();
+        return;
+    }
+
+    if (command == "hdata")
+        hdata(id, arguments);
+    else if (command == "info")
+        info(id, arguments);
+    else if (command == "nicklist")
+        nicklist(id, arguments);
+    else if (command == "sync")
+        sync(arguments, true);
+    else if (command == "desync")
+        sync(arguments, false);
+    else if (command == "input")
+        input(arguments);
+    else if (command == "ping")
+        ping(arguments);
+    else if (command == "quit")
+        close();
+    else
+        qWarning() << "Unsupported command:" << command;
+}
+
+void RelayClient::handshake(const QByteArray &id, const QByteArray &arguments) {
+    QByteArrayList clientAlgorithms { "plain" };
+    QByteArrayList clientCompression;
+    for (auto &option : arguments.split(',')) {
+        auto equals = option.indexOf('=');
+        if (equals < 0)
+            continue;
+        auto key = option.left(equals);
+        auto value = option.mid(equals + 1);
+        if (key == "password_hash_algo")
+            clientAlgorithms = value.split(':');
+        else if (key == "compression")
+            clientCompression = value.split(':');
+    }
+
+    m_hashAlgorithm.clear();
+    for (auto &i : c_hashAlgorithms) {
+        if (clientAlgorithms.contains(i)) {
+            m_hashAlgorithm = i;
+            break;
+        }
+    }
+    // the first acceptable one from the client's list wins
+    m_compression = MessageBuilder::NoCompression;
+    for (auto &i : clientCompression) {
+        if (i == "off")
+            break;
+        m_compression = compressionFor(i);
+        if (m_compression != MessageBuilder::NoCompression)
+            break;
+    }
+    QByteArray compression = c_compressionNames[m_compression];
+
+    QByteArray nonce(16, 0);
+    for (auto &i : nonce)
+        i = char(QRandomGenerator::global()->bounded(256));
+    m_nonce = nonce;
+
+    QList<QPair<QByteArray, QByteArray>> values {
+        { "password_hash_algo", m_hashAlgorithm },
+        { "password_hash_iterations", QByteArray::number(m_server->options().iterations) },
+        { "totp", "off" },
+        { "nonce", m_nonce.toHex().toUpper() },
+        { "compression", compression },
+    };
+    MessageBuilder message(id);
+    message.addHashTableHeader("str", "str", qint32(values.count()));
+    for (auto &i : values) {
+        message.addString(i.first);
+        message.addString(i.second);
+    }
+    // the handshake reply itself is never compressed
+    sendFrame(message.frame(MessageBuilder::NoCompression));
+}
+
+void RelayClient::init(const QByteArray &arguments) {
+    bool ok = false;
+    for (auto &option : arguments.split(',')) {
+        auto equals = option.indexOf('=');
+        if (equals < 0)
+            continue;
+        auto key = option.left(equals);
+        auto value = option.mid(equals + 1);
+        if (key == "password")
+            ok = checkPassword(value, false);
+        else if (key == "password_hash")
+            ok = checkPassword(value, true);
+        else if (key == "compression")
+            m_compression = compressionFor(value);
+    }
+    if (!ok) {
+        qWarning() << "Authentication failed, closing";
+        close();
+        return;
+    }
+    m_authenticated = true;
+    qInfo() << "Client authenticated, compression" << c_compressionNames[m_compression];
+}
+
+MessageBuilder::Compression RelayClient::compressionFor(const QByteArray &name) const {
+    if (!m_server->options().compression)
+        return MessageBuilder::NoCompression;
+    if (name == "zlib")
+        return MessageBuilder::ZlibCompression;
+#ifdef HAVE_ZSTD
+    if (name == "zstd")
+        return MessageBuilder::ZstdCompression;
+#endif // HAVE_ZSTD
+    return MessageBuilder::NoCompression;
+}
+
+bool RelayClient::checkPassword(const QByteArray &value, bool hashed) {
+    auto &password = m_server->options().password;
+    if (!hashed)
+        return (m_hashAlgorithm.isEmpty() || m_hashAlgorithm == "plain") && value == password;
+
+    // algorithm:salt:hash or algorithm:salt:iterations:hash
+    auto parts = value.split(':');
+    if (parts.count() < 3 || parts.first() != m_hashAlgorithm)
+        return false;
+    auto salt = QByteArray::fromHex(parts[1]);
+    auto hash = QByteArray::fromHex(parts.last());
+    if (!salt.startsWith(m_nonce))
+        return false;
+    if (m_hashAlgorithm == "sha256")
+        return QCryptographicHash::hash(salt + password, QCryptographicHash::Sha256) == hash;
+    if (m_hashAlgorithm == "sha512")
+        return QCryptographicHash::hash(salt + password, QCryptographicHash::Sha512) == hash;
+    if (parts.count() != 4 || parts[2].toInt() != m_server->options().iterations)
+        return false;
+    if (m_hashAlgorithm == "pbkdf2+sha256")
+        return QPasswordDigestor::deriveKeyPbkdf2(QCryptographicHash::Sha256, password, salt, m_server->options().iterations, 32) == hash;
+    if (m_hashAlgorithm == "pbkdf2+sha512")
+        return QPasswordDigestor::deriveKeyPbkdf2(QCryptographicHash::Sha512, password, salt, m_server->options().iterations, 64) == hash;
+    return false;
+}
+
+int RelayClient::findBuffer(const QByteArray &name) const {
+    auto &scenario = m_server->scenario();
+    if (name.startsWith("0x")) {
+        bool ok = false;
+        auto ptr = name.mid(2).toULongLong(&ok, 16);
+        return ok ? scenario.bufferIndex(ptr) : -1;
+    }
+    for (int i = 0; i < scenario.buffers().count(); i++) {
+        if (scenario.buffer(i).name == name)
+            return i;
+    }
+    return -1;
+}
+
+void RelayClient::hdata(const QByteArray &id, const QByteArray &arguments) {
+    auto space = arguments.indexOf(' ');
+    auto path = space < 0 ? arguments : arguments.left(space);
+    auto keys = space < 0 ? QByteArrayList() : arguments.mid(space + 1).trimmed().split(',');
+    auto &scenario = m_server->scenario();
+
+    // buffer:gui_buffers(*), buffer:gui_buffers or buffer:0x1234 optionally followed by the path to lines
+    static const QRegularExpression c_buffers(R"(^buffer:(gui_buffers(\(\*\))?|0x[0-9a-fA-F]+)(/lines/(last_line|first_line)\((-?\d+|\*)\)/data)?$)");
+    auto match = c_buffers.match(QString::fromLatin1(path));
+    if (match.hasMatch()) {
+        QList<int> buffers;
+        auto root = match.captured(1);
+        if (root.startsWith("0x")) {
+            auto index = findBuffer(root.toLatin1());
+            if (index >= 0)
+                buffers.append(index);
+        }
+        else {
+            for (int i = 0; i < scenario.buffers().count(); i++) {
+                buffers.append(i);
+                if (match.captured(2).isEmpty())
+                    break;
+            }
+        }
+
+        MessageBuilder message(id);
+        if (match.captured(3).isEmpty()) {
+            m_server->writeBuffers(message, buffers, keys);
+        }
+        else {
+            bool fromEnd = match.captured(4) == "last_line";
+            auto countString = match.captured(5);
+            QList<QPair<int, int>> lines;
+            for (auto buffer : buffers) {
+                int lineCount = scenario.buffer(buffer).lineCount;
+                int count = countString == "*" ? lineCount : qMin(lineCount, qAbs(countString.toInt()));
+                for (int i = 0; i < count; i++)
+                    lines.append({ buffer, fromEnd ? lineCount - 1 - i : i });
+            }
+            m_server->writeLines(message, "buffer/lines/line/line_data", lines, keys);
+        }
+        send(message);
+        return;
+    }
+
+    // line:0x1234/prev_line(-25)/data, the lines before (or after) a known one
+    static const QRegularExpression c_lines(R"(^line:(0x[0-9a-fA-F]+)/(prev_line|next_line)\((-?\d+)\)/data$)");
+    match = c_lines.match(QString::fromLatin1(path));
+    if (match.hasMatch()) {
+        auto linePtr = match.captured(1).mid(2).toULongLong(nullptr, 16);
+        for (int buffer = 0; buffer < scenario.buffers().count(); buffer++) {
+            auto index = scenario.lineIndex(buffer, linePtr);
+            if (index < 0)
+                continue;
+            int step = match.captured(2) == "prev_line" ? -1 : 1;
+            int count = qAbs(match.captured(3).toInt());
+            QList<QPair<int, int>> lines;
+            for (int i = index + step; i >= 0 && i < scenario.buffer(buffer).lineCount && lines.count() < count; i += step)
+                lines.append({ buffer, i });
+            MessageBuilder message(id);
+            m_server->writeLines(message, "line/line/line_data", lines, keys);
+            send(message);
+            return;
+        }
+    }
+
+    if (path == "hotlist:gui_hotlist(*)") {
+        MessageBuilder message(id);
+        m_server->writeHotlist(message, keys);
+        send(message);
+        return;
+    }
+
+    // WeeChat doesn't reply to requests it can't resolve either
+    qWarning() << "Unsupported hdata path:" << path;
+}
+
+void RelayClient::info(const QByteArray &id, const QByteArray &arguments) {
+    auto name = arguments.trimmed();
+    QByteArray value;
+    if (name == "version")
+        value = "4.1.0";
+    else if (name == "version_number")
+        value = QByteArray::number(0x04010000);
+    MessageBuilder message(id);
+    message.addType("inf");
+    message.addString(name);
+    if (value.isNull())
+        message.addNullString();
+    else
+        message.addString(value);
+    send(message);
+}
+
+void RelayClient::nicklist(const QByteArray &id, const QByteArray &arguments) {
+    auto &scenario = m_server->scenario();
+    QList<int> buffers;
+    if (!arguments.trimmed().isEmpty()) {
+        auto index = findBuffer(arguments.trimmed());
+        if (index >= 0)
+            buffers.append(index);
+    }
+    else {
+        for (int i = 0; i < scenario.buffers().count(); i++)
+            buffers.append(i);
+    }
+
+    MessageBuilder message(id);
+    m_server->writeNicks(message, buffers);
+    send(message);
+}
+
+void RelayClient::sync(const QByteArray &arguments, bool enable) {
+    // sync [buffers] [options], buffers is * or a comma separated list, options like buffer,nicklist
+    auto parts = arguments.trimmed().split(' ');
+    QByteArray target = parts.value(0);
+    if (target.isEmpty())
+        target = "*";
+    int flags = 0;
+    if (parts.count() > 1) {
+        for (auto &i : parts[1].split(',')) {
+            if (i == "buffers")
+                flags |= SyncBuffers;
+            else if (i == "upgrade")
+                flags |= SyncUpgrade;
+            else if (i == "buffer")
+                flags |= SyncBuffer;
+            else if (i == "nicklist")
+                flags |= SyncNicklist;
+        }
+    }
+    else {
+        flags = target == "*" ? SyncAll : (SyncBuffer | SyncNicklist);
+    }
+
+    if (target == "*") {
+        m_syncAll = enable ? (m_syncAll | flags) : (m_syncAll & ~flags);
+        return;
+    }
+    for (auto &name : target.split(',')) {
+        auto index = findBuffer(name);
+        if (index < 0)
+            continue;
+        auto ptr = m_server->scenario().buffer(index).ptr;
+        auto value = m_syncBuffers.value(ptr);
+        m_syncBuffers[ptr] = enable ? (value | flags) : (value & ~flags);
+    }
+}
+
+void RelayClient::input(const QByteArray &arguments) {
+    auto space = arguments.indexOf(' ');
+    if (space < 0)
+        return;
+    auto index = findBuffer(arguments.left(space));
+    if (index < 0)
+        return;
+    auto text = arguments.mid(space + 1);
+    if (text.startsWith('/')) {
+        if (text == "/buffer set hotlist -1")
+            m_server->scenario().clearHotlist(index);
+        return;
+    }
+    auto line = m_server->scenario().addLine(index, "lith", text, { "irc_privmsg", "self_msg", "notify_none", "nick_lith", "log1" });
+    m_server->broadcastLine(index, line);
+}
+
+void RelayClient::ping(const QByteArray &arguments) {
+    MessageBuilder message("_pong");
+    message.addType("str");
+    message.addString(arguments);
+    send(message);
+}
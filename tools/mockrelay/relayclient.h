@@ -0,0 +1,91 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RELAYCLIENT_H
+#define RELAYCLIENT_H
+
+#include "messagebuilder.h"
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+
+class QTcpSocket;
+class QWebSocket;
+class RelayServer;
+
+// One connected client, handles the commands it sends
+// https://weechat.org/files/doc/stable/weechat_relay_protocol.en.html#commands
+class RelayClient : public QObject {
+    Q_OBJECT
+public:
+    enum SyncFlag {
+        SyncBuffers = 1 << 0,
+        SyncUpgrade = 1 << 1,
+        SyncBuffer = 1 << 2,
+        SyncNicklist = 1 << 3,
+        SyncAll = SyncBuffers | SyncUpgrade | SyncBuffer | SyncNicklist
+    };
+
+    RelayClient(RelayServer *server, QTcpSocket *socket);
+    RelayClient(RelayServer *server, QWebSocket *socket);
+
+    bool isAuthenticated() const { return m_authenticated; }
+    MessageBuilder::Compression compression() const { return m_compression; }
+    bool isSynced(quint64 buffer, SyncFlag flag) const;
+
+    void send(const MessageBuilder &message);
+    void sendFrame(const QByteArray &frame);
+
+signals:
+    void closed();
+
+private:
+    void onReadyRead();
+    void onTextMessageReceived(const QString &message);
+    void handleLine(QByteArray line);
+    void close();
+
+    void handshake(const QByteArray &id, const QByteArray &arguments);
+    void init(const QByteArray &arguments);
+    bool checkPassword(const QByteArray &value, bool hashed);
+    // what an algorithm named in the handshake means here, NoCompression for the ones this relay can't do
+    MessageBuilder::Compression compressionFor(const QByteArray &name) const;
+    void hdata(const QByteArray &id, const QByteArray &arguments);
+    void info(const QByteArray &id, const QByteArray &arguments);
+    void nicklist(const QByteArray &id, const QByteArray &arguments);
+    void sync(const QByteArray &arguments, bool enable);
+    void input(const QByteArray &arguments);
+    void ping(const QByteArray &arguments);
+
+    // accepts both 0x pointers and full buffer names, -1 if there's no such buffer
+    int findBuffer(const QByteArray &name) const;
+
+    RelayServer *m_server { nullptr };
+    QTcpSocket *m_tcpSocket { nullptr };
+    QWebSocket *m_webSocket { nullptr };
+    QByteArray m_input;
+
+    bool m_authenticated { false };
+    MessageBuilder::Compression m_compression { MessageBuilder::NoCompression };
+    QByteArray m_hashAlgorithm { "plain" };
+    QByteArray m_nonce;
+
+    int m_syncAll { 0 };
+    QHash<quint64, int> m_syncBuffers;
+};
+
+#endif // RELAYCLIENT_H
@@ -0,0 +1,414 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#include "relayserver.h"
+#include "relayclient.h"
+
+#include <QFile>
+#include <QSslCertificate>
+#include <QSslCipher>
+#include <QSslConfiguration>
+#include <QSslKey>
+#include <QSslSocket>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QWebSocketServer>
+#include <QWebSocket>
+#include <QRandomGenerator>
+#include <QDebug>
+
+namespace {
+// Hands out sockets that have already started the server side of the TLS handshake
+// The relay protocol then goes over them the same way as over plain TCP
+class TlsServer : public QTcpServer {
+public:
+    TlsServer(const QSslConfiguration &configuration, QObject *parent)
+        : QTcpServer(parent)
+        , m_configuration(configuration)
+    {
+    }
+
+protected:
+    void incomingConnection(qintptr handle) override {
+        auto socket = new QSslSocket(this);
+        if (!socket->setSocketDescriptor(handle)) {
+            qWarning() << "Can't accept a TLS connection:" << socket->errorString();
+            delete socket;
+            return;
+        }
+        socket->setSslConfiguration(m_configuration);
+        socket->startServerEncryption();
+        addPendingConnection(socket);
+    }
+
+private:
+    QSslConfiguration m_configuration;
+};
+
+bool loadTlsConfiguration(const QString &certificatePath, const QString &keyPath, QSslConfiguration &configuration) {
+    QFile certificateFile(certificatePath);
+    QFile keyFile(keyPath);
+    if (!certificateFile.open(QIODevice::ReadOnly) || !keyFile.open(QIODevice::ReadOnly)) {
+        qCritical() << "Can't read the TLS certificate" << certificatePath << "or key" << keyPath;
+        return false;
+    }
+    QSslCertificate certificate(&certificateFile, QSsl::Pem);
+    auto keyData = keyFile.readAll();
+    QSslKey key;
+    for (auto algorithm : { QSsl::Rsa, QSsl::Ec }) {
+        key = QSslKey(keyData, algorithm, QSsl::Pem);
+        if (!key.isNull())
+            break;
+    }
+    if (certificate.isNull() || key.isNull()) {
+        qCritical() << "The TLS certificate or key isn't a valid PEM file";
+        return false;
+    }
+    configuration = QSslConfiguration::defaultConfiguration();
+    configuration.setLocalCertificate(certificate);
+    configuration.setPrivateKey(key);
+    configuration.setPeerVerifyMode(QSslSocket::VerifyNone);
+    return true;
+}
+
+template <typename T>
+struct Field {
+    const char *name;
+    const char *type;
+    void (*write)(MessageBuilder &message, const T &value);
+};
+
+// Picks the fields the client asked for (in the order it asked for them) and builds the keys header
+template <typename T, size_t N>
+QList<const Field<T>*> selectFields(const Field<T> (&all)[N], const QByteArrayList &keys, QByteArray &header) {
+    QList<const Field<T>*> result;
+    auto add = [&](const Field<T> &field) {
+        if (!header.isEmpty())
+            header.append(',');
+        header.append(field.name).append(':').append(field.type);
+        result.append(&field);
+    };
+    if (keys.isEmpty()) {
+        for (auto &field : all)
+            add(field);
+        return result;
+    }
+    for (auto &key : keys) {
+        for (auto &field : all) {
+            if (key == field.name) {
+                add(field);
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+const Field<Scenario::Buffer> c_bufferFields[] {
+    { "number", "int", [](MessageBuilder &m, const Scenario::Buffer &b) { m.addInt(b.number); } },
+    { "full_name", "str", [](MessageBuilder &m, const Scenario::Buffer &b) { m.addString(b.name); } },
+    { "name", "str", [](MessageBuilder &m, const Scenario::Buffer &b) { m.addString(b.name); } },
+    { "short_name", "str", [](MessageBuilder &m, const Scenario::Buffer &b) { m.addString(b.shortName); } },
+    { "hidden", "int", [](MessageBuilder &m, const Scenario::Buffer &) { m.addInt(0); } },
+    { "title", "str", [](MessageBuilder &m, const Scenario::Buffer &b) { m.addString(b.title); } },
+    { "local_variables", "htb", [](MessageBuilder &m, const Scenario::Buffer &b) {
+        m.addType("str");
+        m.addType("str");
+        m.addInt(qint32(b.localVariables.count()));
+        for (auto &i : b.localVariables) {
+            m.addString(i.first);
+            m.addString(i.second);
+        }
+    } },
+};
+
+const Field<Scenario::Line> c_lineFields[] {
+    { "buffer", "ptr", [](MessageBuilder &m, const Scenario::Line &l) { m.addPointer(l.buffer); } },
+    { "date", "tim", [](MessageBuilder &m, const Scenario::Line &l) { m.addTime(l.date); } },
+    { "date_printed", "tim", [](MessageBuilder &m, const Scenario::Line &l) { m.addTime(l.date); } },
+    { "displayed", "chr", [](MessageBuilder &m, const Scenario::Line &l) { m.addChar(l.displayed); } },
+    { "notify_level", "chr", [](MessageBuilder &m, const Scenario::Line &l) { m.addChar(l.highlight ? 3 : 1); } },
+    { "highlight", "chr", [](MessageBuilder &m, const Scenario::Line &l) { m.addChar(l.highlight); } },
+    { "tags_array", "arr", [](MessageBuilder &m, const Scenario::Line &l) {
+        m.addArrayHeader("str", qint32(l.tags.count()));
+        for (auto &i : l.tags)
+            m.addString(i);
+    } },
+    { "prefix", "str", [](MessageBuilder &m, const Scenario::Line &l) { m.addString(l.prefix); } },
+    { "message", "str", [](MessageBuilder &m, const Scenario::Line &l) { m.addString(l.message); } },
+};
+
+struct HotlistEntry {
+    const Scenario::Buffer &buffer;
+};
+
+const Field<HotlistEntry> c_hotlistFields[] {
+    { "priority", "int", [](MessageBuilder &m, const HotlistEntry &h) { m.addInt(h.buffer.hotlist[3] > 0 ? 3 : h.buffer.hotlist[2] > 0 ? 2 : 1); } },
+    { "creation_time.tv_sec", "tim", [](MessageBuilder &m, const HotlistEntry &h) { m.addTime(h.buffer.liveDates.isEmpty() ? 0 : h.buffer.liveDates.last()); } },
+    { "creation_time.tv_usec", "lon", [](MessageBuilder &m, const HotlistEntry &) { m.addLong(0); } },
+    { "buffer", "ptr", [](MessageBuilder &m, const HotlistEntry &h) { m.addPointer(h.buffer.ptr); } },
+    { "count", "arr", [](MessageBuilder &m, const HotlistEntry &h) {
+        m.addArrayHeader("int", qint32(h.buffer.hotlist.count()));
+        for (auto i : h.buffer.hotlist)
+            m.addInt(i);
+    } },
+};
+
+const Field<Scenario::Nick> c_nickFields[] {
+    { "group", "chr", [](MessageBuilder &m, const Scenario::Nick &n) { m.addChar(n.group); } },
+    { "visible", "chr", [](MessageBuilder &m, const Scenario::Nick &n) { m.addChar(n.visible); } },
+    { "level", "int", [](MessageBuilder &m, const Scenario::Nick &n) { m.addInt(n.level); } },
+    { "name", "str", [](MessageBuilder &m, const Scenario::Nick &n) { m.addString(n.name); } },
+    { "color", "str", [](MessageBuilder &m, const Scenario::Nick &n) { m.addString(n.color); } },
+    { "prefix", "str", [](MessageBuilder &m, const Scenario::Nick &n) { m.addString(n.prefix); } },
+    { "prefix_color", "str", [](MessageBuilder &m, const Scenario::Nick &) { m.addString("lightgreen"); } },
+};
+}
+
+RelayServer::RelayServer(const RelayOptions &options, const ScenarioOptions &scenarioOptions, QObject *parent)
+    : QObject(parent)
+    , m_options(options)
+    , m_scenario(scenarioOptions)
+{
+    connect(m_lineTimer, &QTimer::timeout, this, &RelayServer::onLineTimeout);
+    connect(m_netsplitTimer, &QTimer::timeout, this, &RelayServer::onNetsplitTimeout);
+}
+
+bool RelayServer::listen(quint16 tcpPort, quint16 webSocketPort, quint16 tlsPort) {
+    if (tcpPort > 0) {
+        m_tcpServer = new QTcpServer(this);
+        connect(m_tcpServer, &QTcpServer::newConnection, this, &RelayServer::onNewTcpConnection);
+        if (!m_tcpServer->listen(QHostAddress::Any, tcpPort)) {
+            qCritical() << "Can't listen on TCP port" << tcpPort << m_tcpServer->errorString();
+            return false;
+        }
+        qInfo() << "Listening for TCP connections on port" << tcpPort;
+    }
+    if (tlsPort > 0) {
+        QSslConfiguration configuration;
+        if (!loadTlsConfiguration(m_options.tlsCertificate, m_options.tlsKey, configuration))
+            return false;
+        m_tlsServer = new TlsServer(configuration, this);
+        connect(m_tlsServer, &QTcpServer::newConnection, this, &RelayServer::onNewTlsConnection);
+        if (!m_tlsServer->listen(QHostAddress::Any, tlsPort)) {
+            qCritical() << "Can't listen on TLS port" << tlsPort << m_tlsServer->errorString();
+            return false;
+        }
+        qInfo() << "Listening for TLS connections on port" << tlsPort;
+    }
+    if (webSocketPort > 0) {
+        m_webSocketServer = new QWebSocketServer("weechat", QWebSocketServer::NonSecureMode, this);
+        connect(m_webSocketServer, &QWebSocketServer::newConnection, this, &RelayServer::onNewWebSocketConnection);
+        if (!m_webSocketServer->listen(QHostAddress::Any, webSocketPort)) {
+            qCritical() << "Can't listen on WebSocket port" << webSocketPort << m_webSocketServer->errorString();
+            return false;
+        }
+        qInfo() << "Listening for WebSocket connections on port" << webSocketPort;
+    }
+
+    m_clock.start();
+    if (m_scenario.options().linesPerSecond > 0)
+        m_lineTimer->start(qBound(1, int(1000 / m_scenario.options().linesPerSecond), 100));
+    if (m_scenario.options().netsplitInterval > 0)
+        m_netsplitTimer->start(m_scenario.options().netsplitInterval * 1000);
+    return true;
+}
+
+void RelayServer::writeBuffers(MessageBuilder &message, const QList<int> &buffers, const QByteArrayList &keys) {
+    QByteArray header;
+    auto fields = selectFields(c_bufferFields, keys, header);
+    message.addHDataHeader("buffer", header, qint32(buffers.count()));
+    for (auto index : buffers) {
+        auto &buffer = m_scenario.buffer(index);
+        message.addPointer(buffer.ptr);
+        for (auto field : fields)
+            field->write(message, buffer);
+    }
+}
+
+void RelayServer::writeLines(MessageBuilder &message, const QByteArray &path, const QList<QPair<int, int>> &lines, const QByteArrayList &keys) {
+    QByteArray header;
+    auto fields = selectFields(c_lineFields, keys, header);
+    auto depth = path.count('/') + 1;
+    message.addHDataHeader(path, header, qint32(lines.count()));
+    for (auto &i : lines) {
+        auto line = m_scenario.line(i.first, i.second);
+        // buffer/lines/line/line_data, the mock doesn't distinguish line and line_data pointers
+        if (depth >= 4) {
+            message.addPointer(line.buffer);
+            message.addPointer(line.buffer + 1);
+        }
+        for (int j = depth >= 4 ? 2 : 0; j < depth; j++)
+            message.addPointer(line.ptr);
+        for (auto field : fields)
+            field->write(message, line);
+    }
+}
+
+void RelayServer::writeHotlist(MessageBuilder &message, const QByteArrayList &keys) {
+    QByteArray header;
+    auto fields = selectFields(c_hotlistFields, keys, header);
+    auto countPosition = message.addHDataHeader("hotlist", header);
+    qint32 count = 0;
+    for (int i = 0; i < m_scenario.buffers().count(); i++) {
+        auto &buffer = m_scenario.buffer(i);
+        if (buffer.hotlist == QList<int> { 0, 0, 0, 0 })
+            continue;
+        message.addPointer(m_scenario.hotlistPointer(i));
+        for (auto field : fields)
+            field->write(message, HotlistEntry { buffer });
+        count++;
+    }
+    message.setInt(countPosition, count);
+}
+
+void RelayServer::writeNicks(MessageBuilder &message, const QList<int> &buffers) {
+    QByteArray header;
+    auto fields = selectFields(c_nickFields, {}, header);
+    qint32 count = 0;
+    for (auto i : buffers)
+        count += qint32(m_scenario.buffer(i).nicks.count());
+    message.addHDataHeader("buffer/nicklist_item", header, count);
+    for (auto i : buffers) {
+        auto &buffer = m_scenario.buffer(i);
+        for (auto &nick : buffer.nicks) {
+            message.addPointer(buffer.ptr);
+            message.addPointer(nick.ptr);
+            for (auto field : fields)
+                field->write(message, nick);
+        }
+    }
+}
+
+void RelayServer::writeNicklistDiff(MessageBuilder &message, int buffer, const QList<Scenario::Nick> &nicks, char diff) {
+    QByteArray header;
+    auto fields = selectFields(c_nickFields, {}, header);
+    header.prepend("_diff:chr,");
+    auto ptr = m_scenario.buffer(buffer).ptr;
+    // a diff starts with the group the nicks belong to
+    message.addHDataHeader("buffer/nicklist_item", header, qint32(nicks.count() + 1));
+    auto writeNick = [&](const Scenario::Nick &nick, char op) {
+        message.addPointer(ptr);
+        message.addPointer(nick.ptr);
+        message.addChar(op);
+        for (auto field : fields)
+            field->write(message, nick);
+    };
+    writeNick(m_scenario.buffer(buffer).nicks.first(), '^');
+    for (auto &nick : nicks)
+        writeNick(nick, diff);
+}
+
+void RelayServer::broadcastLine(int buffer, int line) {
+    MessageBuilder message("_buffer_line_added");
+    writeLines(message, "line_data", { { buffer, line } }, {});
+    // only build each variant of the frame once for all the clients
+    QByteArray frames[3];
+    auto ptr = m_scenario.buffer(buffer).ptr;
+    for (auto client : m_clients) {
+        if (!client->isAuthenticated() || !client->isSynced(ptr, RelayClient::SyncBuffer))
+            continue;
+        auto &frame = frames[client->compression()];
+        if (frame.isEmpty())
+            frame = message.frame(client->compression());
+        client->sendFrame(frame);
+    }
+}
+
+void RelayServer::broadcastNicklistDiff(int buffer, const QList<Scenario::Nick> &nicks, char diff) {
+    MessageBuilder message("_nicklist_diff");
+    writeNicklistDiff(message, buffer, nicks, diff);
+    QByteArray frames[3];
+    auto ptr = m_scenario.buffer(buffer).ptr;
+    for (auto client : m_clients) {
+        if (!client->isAuthenticated() || !client->isSynced(ptr, RelayClient::SyncNicklist))
+            continue;
+        auto &frame = frames[client->compression()];
+        if (frame.isEmpty())
+            frame = message.frame(client->compression());
+        client->sendFrame(frame);
+    }
+}
+
+void RelayServer::onNewTcpConnection() {
+    while (auto socket = m_tcpServer->nextPendingConnection()) {
+        qInfo() << "New TCP client from" << socket->peerAddress().toString();
+        auto client = new RelayClient(this, socket);
+        connect(client, &RelayClient::closed, this, &RelayServer::onClientClosed);
+        m_clients.append(client);
+    }
+}
+
+void RelayServer::onNewTlsConnection() {
+    while (auto socket = qobject_cast<QSslSocket*>(m_tlsServer->nextPendingConnection())) {
+        qInfo() << "New TLS client from" << socket->peerAddress().toString();
+        // whether the session was resumed shows on the client, in how long it took to connect
+        connect(socket, &QSslSocket::encrypted, this, [socket]() {
+            qInfo() << "TLS handshake with" << socket->peerAddress().toString() << "done," << socket->sessionProtocol() << socket->sessionCipher().name();
+        });
+        connect(socket, &QSslSocket::sslErrors, this, [](const QList<QSslError> &errors) {
+            for (auto &i : errors)
+                qWarning() << "TLS error:" << i.errorString();
+        });
+        auto client = new RelayClient(this, socket);
+        connect(client, &RelayClient::closed, this, &RelayServer::onClientClosed);
+        m_clients.append(client);
+    }
+}
+
+void RelayServer::onNewWebSocketConnection() {
+    while (auto socket = m_webSocketServer->nextPendingConnection()) {
+        qInfo() << "New WebSocket client from" << socket->peerAddress().toString();
+        auto client = new RelayClient(this, socket);
+        connect(client, &RelayClient::closed, this, &RelayServer::onClientClosed);
+        m_clients.append(client);
+    }
+}
+
+void RelayServer::onClientClosed() {
+    auto client = qobject_cast<RelayClient*>(sender());
+    m_clients.removeAll(client);
+    client->deleteLater();
+}
+
+void RelayServer::onLineTimeout() {
+    // timers aren't precise enough for high rates, catch up with the clock instead
+    auto due = qint64(m_clock.elapsed() * m_scenario.options().linesPerSecond / 1000.0);
+    while (m_linesSent < due) {
+        int buffer = 0;
+        auto line = m_scenario.addRandomLine(&buffer);
+        broadcastLine(buffer, line);
+        m_linesSent++;
+    }
+}
+
+void RelayServer::onNetsplitTimeout() {
+    QList<int> channels;
+    for (int i = 0; i < m_scenario.buffers().count(); i++) {
+        if (m_scenario.buffer(i).channel && m_scenario.buffer(i).splitNicks.isEmpty())
+            channels.append(i);
+    }
+    if (channels.isEmpty())
+        return;
+    int buffer = channels[QRandomGenerator::global()->bounded(int(channels.count()))];
+    auto nicks = m_scenario.split(buffer);
+    qInfo() << "Netsplit in" << m_scenario.buffer(buffer).name << "-" << nicks.count() << "nicks";
+    broadcastNicklistDiff(buffer, nicks, '-');
+    // everyone comes back halfway to the next split
+    QTimer::singleShot(m_scenario.options().netsplitInterval * 500, this, [this, buffer]() {
+        broadcastNicklistDiff(buffer, m_scenario.rejoin(buffer), '+');
+    });
+}
@@ -0,0 +1,90 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RELAYSERVER_H
+#define RELAYSERVER_H
+
+#include "messagebuilder.h"
+#include "scenario.h"
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+
+class QTcpServer;
+class QWebSocketServer;
+class RelayClient;
+
+struct RelayOptions {
+    QByteArray password { "test" };
+    int iterations { 1000 };
+    bool compression { true };
+    // milliseconds every reply is held back, like a round trip over a slow network would
+    int latency { 0 };
+    // PEM files for the TLS listener, a self-signed certificate is fine
+    QString tlsCertificate;
+    QString tlsKey;
+};
+
+// Listens for Lith on TCP, TLS and WebSocket and plays the scenario to every synced client
+class RelayServer : public QObject {
+    Q_OBJECT
+public:
+    RelayServer(const RelayOptions &options, const ScenarioOptions &scenarioOptions, QObject *parent = nullptr);
+
+    // a port of 0 disables that listener
+    bool listen(quint16 tcpPort, quint16 webSocketPort, quint16 tlsPort);
+
+    const RelayOptions &options() const { return m_options; }
+    Scenario &scenario() { return m_scenario; }
+
+    // keys are the ones the client asked for, all of them if empty
+    void writeBuffers(MessageBuilder &message, const QList<int> &buffers, const QByteArrayList &keys);
+    void writeLines(MessageBuilder &message, const QByteArray &path, const QList<QPair<int, int>> &lines, const QByteArrayList &keys);
+    void writeHotlist(MessageBuilder &message, const QByteArrayList &keys);
+    // the whole nicklist of all the buffers
+    void writeNicks(MessageBuilder &message, const QList<int> &buffers);
+    // diff is '+' or '-'
+    void writeNicklistDiff(MessageBuilder &message, int buffer, const QList<Scenario::Nick> &nicks, char diff);
+
+    // a line was added to the scenario, every client synced to the buffer gets it
+    void broadcastLine(int buffer, int line);
+
+private slots:
+    void onNewTcpConnection();
+    void onNewTlsConnection();
+    void onNewWebSocketConnection();
+    void onClientClosed();
+    void onLineTimeout();
+    void onNetsplitTimeout();
+
+private:
+    void broadcastNicklistDiff(int buffer, const QList<Scenario::Nick> &nicks, char diff);
+
+    RelayOptions m_options;
+    Scenario m_scenario;
+    QTcpServer *m_tcpServer { nullptr };
+    QTcpServer *m_tlsServer { nullptr };
+    QWebSocketServer *m_webSocketServer { nullptr };
+    QList<RelayClient*> m_clients;
+
+    QTimer *m_lineTimer { new QTimer(this) };
+    QTimer *m_netsplitTimer { new QTimer(this) };
+    QElapsedTimer m_clock;
+    qint64 m_linesSent { 0 };
+};
+
+#endif // RELAYSERVER_H
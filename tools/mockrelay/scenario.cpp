@@ -0,0 +1,238 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#include "scenario.h"
+
+#include <QDateTime>
+#include <QRandomGenerator>
+
+// Lith keys lines by buffer and line pointer packed into 64 bits, keep all pointers below 32 bits
+static constexpr quint64 c_bufferBase { 0x10000000 };
+static constexpr quint64 c_nickBase { 0x20000000 };
+static constexpr quint64 c_hotlistBase { 0x30000000 };
+static constexpr quint64 c_lineBase { 0x80000000 };
+static constexpr int c_lineBits { 20 };
+static constexpr int c_maxBuffers { 1 << (31 - c_lineBits) };
+
+static const char *c_words[] {
+    "the", "relay", "works", "again", "after", "restart", "anyone", "tried", "latest", "build",
+    "with", "zlib", "compression", "weechat", "client", "lag", "is", "terrible", "today", "fixed",
+    "it", "yesterday", "patch", "review", "please", "merge", "thanks", "lol", "ok", "sure",
+    "why", "not", "server", "split", "again", "netsplit", "coffee", "meeting", "later", "ping"
+};
+
+static QByteArray colored(int color, const QByteArray &text) {
+    // 0x19 F xx sets the foreground, 0x1C resets everything
+    return "\x19" "F" + QByteArray::number(color).rightJustified(2, '0') + text + "\x1C";
+}
+
+Scenario::Scenario(const ScenarioOptions &options)
+    : m_options(options)
+{
+    m_options.buffers = qBound(1, m_options.buffers, c_maxBuffers);
+    m_options.historyLines = qBound(0, m_options.historyLines, (1 << c_lineBits) - 1);
+    m_startTime = QDateTime::currentSecsSinceEpoch() - m_options.historyLines * 60;
+
+    QRandomGenerator rng(m_options.seed);
+    for (int b = 0; b < m_options.buffers; b++) {
+        Buffer buffer;
+        buffer.ptr = c_bufferBase + (quint64(b) << 8);
+        buffer.number = b + 1;
+        buffer.lineCount = m_options.historyLines;
+        int network = b / 10;
+        if (b == 0) {
+            buffer.name = "core.weechat";
+            buffer.shortName = "weechat";
+            buffer.title = "WeeChat (mock relay)";
+            buffer.localVariables = { { "plugin", "core" }, { "name", "weechat" } };
+        }
+        else if (b % 10 == 1) {
+            auto server = "net" + QByteArray::number(network);
+            buffer.name = "irc.server." + server;
+            buffer.shortName = server;
+            buffer.title = "IRC: " + server + ".example.org/6697";
+            buffer.localVariables = { { "plugin", "irc" }, { "name", "server." + server }, { "type", "server" }, { "server", server }, { "nick", "lith" } };
+        }
+        else if (b % 10 == 9) {
+            auto server = "net" + QByteArray::number(network);
+            auto nick = "friend" + QByteArray::number(b);
+            buffer.name = "irc." + server + "." + nick;
+            buffer.shortName = nick;
+            buffer.title = nick + "!~" + nick + "@example.org";
+            buffer.localVariables = { { "plugin", "irc" }, { "name", server + "." + nick }, { "type", "private" }, { "server", server }, { "channel", nick }, { "nick", "lith" } };
+        }
+        else {
+            auto server = "net" + QByteArray::number(network);
+            auto channel = "#channel" + QByteArray::number(b);
+            buffer.name = "irc." + server + "." + channel;
+            buffer.shortName = channel;
+            buffer.title = "Welcome to " + colored(12, channel) + ", see https://example.org/" + channel.mid(1) + " for the rules";
+            buffer.localVariables = { { "plugin", "irc" }, { "name", server + "." + channel }, { "type", "channel" }, { "server", server }, { "channel", channel }, { "nick", "lith" } };
+            buffer.channel = true;
+        }
+
+        Nick root;
+        root.ptr = c_nickBase + (quint64(b) << 12);
+        root.name = "root";
+        root.group = true;
+        root.visible = false;
+        buffer.nicks.append(root);
+        if (buffer.channel) {
+            for (int n = 0; n < m_options.nicksPerChannel; n++) {
+                Nick nick;
+                nick.ptr = root.ptr + n + 1;
+                nick.name = "user" + QByteArray::number(rng.bounded(100000));
+                auto roll = rng.bounded(100);
+                nick.prefix = roll < 5 ? "@" : roll < 15 ? "+" : " ";
+                nick.color = "default";
+                nick.level = 0;
+                buffer.nicks.append(nick);
+            }
+        }
+        m_buffers.append(buffer);
+    }
+}
+
+int Scenario::bufferIndex(quint64 ptr) const {
+    for (int i = 0; i < m_buffers.count(); i++) {
+        if (m_buffers[i].ptr == ptr)
+            return i;
+    }
+    return -1;
+}
+
+Scenario::Line Scenario::line(int bufferIndex, int lineIndex) const {
+    auto &buffer = m_buffers[bufferIndex];
+    auto it = buffer.customLines.constFind(lineIndex);
+    if (it != buffer.customLines.constEnd())
+        return *it;
+    return generatedLine(bufferIndex, lineIndex);
+}
+
+int Scenario::lineIndex(int bufferIndex, quint64 linePtr) const {
+    if ((linePtr & ~quint64((1 << c_lineBits) - 1)) != (c_lineBase | (quint64(bufferIndex) << c_lineBits)))
+        return -1;
+    int index = int(linePtr & ((1 << c_lineBits) - 1));
+    return index < m_buffers[bufferIndex].lineCount ? index : -1;
+}
+
+quint64 Scenario::hotlistPointer(int bufferIndex) const {
+    return c_hotlistBase + bufferIndex;
+}
+
+Scenario::Line Scenario::generatedLine(int bufferIndex, int lineIndex) const {
+    auto &buffer = m_buffers[bufferIndex];
+    QRandomGenerator rng(m_options.seed ^ quint32(bufferIndex * 1000003) ^ quint32(lineIndex * 2654435761u));
+
+    Line line;
+    line.ptr = c_lineBase | (quint64(bufferIndex) << c_lineBits) | quint64(lineIndex & ((1 << c_lineBits) - 1));
+    line.buffer = buffer.ptr;
+    if (lineIndex < m_options.historyLines)
+        line.date = m_startTime + qint64(lineIndex) * 60;
+    else
+        line.date = buffer.liveDates.value(lineIndex - m_options.historyLines, QDateTime::currentSecsSinceEpoch());
+
+    if (!buffer.channel || buffer.nicks.count() < 2) {
+        line.prefix = colored(5, "--");
+        line.message = "Server notice number " + QByteArray::number(lineIndex);
+        line.tags = { "irc_notice", "notify_private", "log3" };
+        return line;
+    }
+
+    auto &nick = buffer.nicks[1 + rng.bounded(buffer.nicks.count() - 1)];
+    auto roll = rng.bounded(100);
+    if (roll < 5) {
+        line.prefix = colored(9, "-->");
+        line.message = colored(14, nick.name) + " (~" + nick.name + "@example.org) has joined " + buffer.shortName;
+        line.tags = { "irc_join", "nick_" + nick.name, "log4" };
+        return line;
+    }
+    if (roll < 10) {
+        line.prefix = colored(1, "<--");
+        line.message = colored(14, nick.name) + " (~" + nick.name + "@example.org) has quit (Ping timeout)";
+        line.tags = { (roll < 8 ? "irc_quit" : "irc_part"), "nick_" + nick.name, "log4" };
+        return line;
+    }
+
+    QByteArrayList words;
+    int count = 3 + rng.bounded(18);
+    for (int i = 0; i < count; i++) {
+        QByteArray word = c_words[rng.bounded(int(sizeof(c_words) / sizeof(*c_words)))];
+        if (rng.bounded(100) < 3)
+            word = colored(rng.bounded(16), word);
+        words.append(word);
+    }
+    if (rng.bounded(100) < 10)
+        words.append("https://example.org/some/path/" + QByteArray::number(lineIndex) + "?query=value&other=1");
+    line.prefix = nick.prefix.trimmed() + colored(rng.bounded(16), nick.name);
+    line.message = words.join(' ');
+    line.tags = { "irc_privmsg", "notify_message", "prefix_nick_" + nick.color, "nick_" + nick.name, "log1" };
+    if (rng.bounded(100) < 2) {
+        line.highlight = true;
+        line.tags.append("notify_highlight");
+    }
+    return line;
+}
+
+int Scenario::addRandomLine(int *bufferIndex) {
+    int index = QRandomGenerator::global()->bounded(m_buffers.count());
+    auto &buffer = m_buffers[index];
+    buffer.liveDates.append(QDateTime::currentSecsSinceEpoch());
+    int lineIndex = buffer.lineCount++;
+    buffer.hotlist[1]++;
+    if (bufferIndex)
+        *bufferIndex = index;
+    return lineIndex;
+}
+
+int Scenario::addLine(int bufferIndex, const QByteArray &prefix, const QByteArray &message, const QByteArrayList &tags) {
+    auto &buffer = m_buffers[bufferIndex];
+    buffer.liveDates.append(QDateTime::currentSecsSinceEpoch());
+    int lineIndex = buffer.lineCount++;
+
+    Line line;
+    line.ptr = c_lineBase | (quint64(bufferIndex) << c_lineBits) | quint64(lineIndex & ((1 << c_lineBits) - 1));
+    line.buffer = buffer.ptr;
+    line.date = buffer.liveDates.last();
+    line.prefix = prefix;
+    line.message = message;
+    line.tags = tags;
+    buffer.customLines.insert(lineIndex, line);
+    return lineIndex;
+}
+
+void Scenario::clearHotlist(int bufferIndex) {
+    m_buffers[bufferIndex].hotlist = { 0, 0, 0, 0 };
+}
+
+QList<Scenario::Nick> Scenario::split(int bufferIndex) {
+    auto &buffer = m_buffers[bufferIndex];
+    if (!buffer.channel || !buffer.splitNicks.isEmpty())
+        return {};
+    int count = qMin(m_options.netsplitSize, int(buffer.nicks.count()) - 1);
+    // the last ones leave, the root group stays
+    buffer.splitNicks = buffer.nicks.mid(buffer.nicks.count() - count);
+    buffer.nicks.resize(buffer.nicks.count() - count);
+    return buffer.splitNicks;
+}
+
+QList<Scenario::Nick> Scenario::rejoin(int bufferIndex) {
+    auto &buffer = m_buffers[bufferIndex];
+    auto nicks = buffer.splitNicks;
+    buffer.nicks.append(nicks);
+    buffer.splitNicks.clear();
+    return nicks;
+}
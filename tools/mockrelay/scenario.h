@@ -0,0 +1,111 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include <QByteArray>
+#include <QByteArrayList>
+#include <QHash>
+#include <QList>
+#include <QPair>
+
+struct ScenarioOptions {
+    int buffers { 20 };
+    int nicksPerChannel { 50 };
+    int historyLines { 200 };
+    // new lines over all buffers, 0 disables them
+    double linesPerSecond { 1.0 };
+    // seconds between netsplits, 0 disables them
+    int netsplitInterval { 0 };
+    int netsplitSize { 20 };
+    quint32 seed { 1 };
+};
+
+// The state of the pretend WeeChat
+// Lines are generated from their index so even a huge history doesn't take any memory
+class Scenario {
+public:
+    struct Nick {
+        quint64 ptr { 0 };
+        QByteArray name;
+        QByteArray prefix;
+        QByteArray color;
+        bool group { false };
+        bool visible { true };
+        int level { 0 };
+    };
+    struct Line {
+        quint64 ptr { 0 };
+        quint64 buffer { 0 };
+        qint64 date { 0 };
+        bool displayed { true };
+        bool highlight { false };
+        QByteArrayList tags;
+        QByteArray prefix;
+        QByteArray message;
+    };
+    struct Buffer {
+        quint64 ptr { 0 };
+        int number { 0 };
+        QByteArray name;
+        QByteArray shortName;
+        QByteArray title;
+        QList<QPair<QByteArray, QByteArray>> localVariables;
+        bool channel { false };
+        // the first item is the root group
+        QList<Nick> nicks;
+        // nicks that left in a netsplit and will come back
+        QList<Nick> splitNicks;
+        int lineCount { 0 };
+        QList<qint64> liveDates;
+        QHash<int, Line> customLines;
+        // low, message, private, highlight
+        QList<int> hotlist { 0, 0, 0, 0 };
+    };
+
+    explicit Scenario(const ScenarioOptions &options);
+
+    const ScenarioOptions &options() const { return m_options; }
+    const QList<Buffer> &buffers() const { return m_buffers; }
+    const Buffer &buffer(int index) const { return m_buffers[index]; }
+    int bufferIndex(quint64 ptr) const;
+
+    // index 0 is the oldest line
+    Line line(int bufferIndex, int lineIndex) const;
+    // -1 if the pointer doesn't belong to a line of the buffer
+    int lineIndex(int bufferIndex, quint64 linePtr) const;
+    quint64 hotlistPointer(int bufferIndex) const;
+
+    // both return the index of the new line
+    int addRandomLine(int *bufferIndex);
+    int addLine(int bufferIndex, const QByteArray &prefix, const QByteArray &message, const QByteArrayList &tags);
+    void clearHotlist(int bufferIndex);
+
+    // the nicks that left, empty if a split is already in progress in the buffer
+    QList<Nick> split(int bufferIndex);
+    QList<Nick> rejoin(int bufferIndex);
+
+private:
+    Line generatedLine(int bufferIndex, int lineIndex) const;
+
+    ScenarioOptions m_options;
+    QList<Buffer> m_buffers;
+    qint64 m_startTime { 0 };
+    quint32 m_liveCounter { 0 };
+};
+
+#endif // SCENARIO_H
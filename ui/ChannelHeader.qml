@@ -83,7 +83,7 @@ Frame {
                       lith.status === Lith.UNCONFIGURED ? "Not configured" :
                       lith.status === Lith.CONNECTING ? "Connecting" :
                       lith.status === Lith.CONNECTED ? "Connected" :
-                      lith.status === Lith.DISCONNECTED ? "Disconnected" :
+                      lith.status === Lith.DISCONNECTED ? (lith.reconnectAttempt > 1 ? "Disconnected, reconnection attempt " + lith.reconnectAttempt : "Disconnected") :
                       lith.status === Lith.ERROR ? "Error: " + lith.errorString :
                                                    ""
                 elide: Text.ElideRight
@@ -113,7 +113,8 @@ Frame {
                 nickDrawer.visible = !nickDrawer.visible
                 if(!mobilePlatform) nickDrawer.open()
             }
-            icon.source: lith.status === Lith.CONNECTING   ? "qrc:/navigation/"+currentTheme+"/transfer.png" :
+            // still transferring when commands are stuck waiting for a slow connection
+            icon.source: lith.status === Lith.CONNECTING || (lith.status === Lith.CONNECTED && lith.sendQueueCongested) ? "qrc:/navigation/"+currentTheme+"/transfer.png" :
                          lith.status === Lith.CONNECTED    ? "qrc:/navigation/"+currentTheme+"/smile.png" :
                          lith.status === Lith.DISCONNECTED ? "qrc:/navigation/"+currentTheme+"/no-wifi.png" :
                          lith.status === Lith.ERROR        ? "qrc:/navigation/"+currentTheme+"/sleeping.png" :
@@ -0,0 +1,111 @@
+// Lith
+// Copyright (C) 2020 Martin Bříza
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; If not, see <http://www.gnu.org/licenses/>.
+
+import QtQuick 2.12
+import QtQuick.Controls 2.12
+import QtQuick.Layouts 1.12
+
+import lith 1.0
+
+ScrollView {
+    id: root
+    clip: true
+    ScrollBar.horizontal.policy: ScrollBar.AlwaysOff
+
+    property var metrics: lith.metrics
+
+    function formatBytes(bytes) {
+        if (bytes >= 1024 * 1024)
+            return (bytes / 1024 / 1024).toFixed(1) + " MiB"
+        if (bytes >= 1024)
+            return (bytes / 1024).toFixed(1) + " KiB"
+        return bytes + " B"
+    }
+    function formatTime(microseconds) {
+        if (microseconds < 0)
+            return "-"
+        if (microseconds >= 1000)
+            return (microseconds / 1000).toFixed(1) + " ms"
+        return Math.round(microseconds) + " µs"
+    }
+
+    ColumnLayout {
+        x: 6
+        y: 6
+        width: root.width - 12
+        GridLayout {
+            Layout.alignment: Qt.AlignHCenter
+            columns: 2
+            Label {
+                text: qsTr("Received")
+            }
+            Label {
+                text: formatBytes(metrics.bytesReceived) + " (" + formatBytes(metrics.bytesDecompressed) + " decompressed)"
+            }
+            Label {
+                text: qsTr("Compression ratio")
+            }
+            Label {
+                text: metrics.compressionRatio.toFixed(2)
+            }
+            Label {
+                text: qsTr("Bytes per line")
+            }
+            Label {
+                text: metrics.bytesPerLine > 0 ? metrics.bytesPerLine.toFixed(0) : "-"
+            }
+            Label {
+                text: qsTr("Sent")
+            }
+            Label {
+                text: formatBytes(metrics.bytesSent)
+            }
+            Label {
+                text: qsTr("Messages")
+            }
+            Label {
+                text: metrics.frames + " (" + metrics.framesPerSecond.toFixed(1) + " per second)"
+            }
+            Label {
+                text: qsTr("Decompression")
+            }
+            Label {
+                text: formatTime(metrics.decompressTimeAverage) + " avg, " + formatTime(metrics.decompressTimeP95) + " p95, " + formatTime(metrics.decompressTimeMax) + " max"
+            }
+            Label {
+                text: qsTr("Parsing")
+            }
+            Label {
+                text: formatTime(metrics.parseTimeAverage) + " avg, " + formatTime(metrics.parseTimeP95) + " p95, " + formatTime(metrics.parseTimeMax) + " max"
+            }
+            Label {
+                text: qsTr("Ping")
+            }
+            Label {
+                text: formatTime(metrics.pingLatency) + " (" + formatTime(metrics.pingLatencyAverage) + " avg, " + formatTime(metrics.pingLatencyMax) + " max)"
+            }
+            Label {
+                text: qsTr("Connecting")
+            }
+            Label {
+                text: formatTime(metrics.connectTime)
+            }
+        }
+        Item {
+            Layout.fillHeight: true
+        }
+    }
+}
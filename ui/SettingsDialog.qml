@@ -37,8 +37,9 @@ Dialog {
         width: parent.width
 
         Repeater {
-            model: mobilePlatform ? [qsTr("Connection"), qsTr("Interface")]
-                                  : [qsTr("Connection"), qsTr("Interface"), qsTr("Shortcuts")]
+            // Shortcuts has to stay the last one, it's not there on mobile
+            model: mobilePlatform ? [qsTr("Connection"), qsTr("Interface"), qsTr("Diagnostics")]
+                                  : [qsTr("Connection"), qsTr("Interface"), qsTr("Diagnostics"), qsTr("Shortcuts")]
 
             delegate: TabButton {
                 text: modelData
@@ -73,6 +74,10 @@ Dialog {
             id: settingsInterface
         }
 
+        SettingsDiagnostics {
+            id: settingsDiagnostics
+        }
+
         SettingsShortcuts {
             id: settingsShortcuts
             enabled: !mobilePlatform
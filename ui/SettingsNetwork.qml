@@ -35,6 +35,10 @@ ScrollView {
         settings.allowSelfSignedCertificates = selfSignedCertificateCheckbox.checked
         settings.handshakeAuth = handshakeAuthCheckbox.checked
         settings.connectionCompression = connectionCompressionCheckbox.checked
+        settings.connectionCompressionOrder = connectionCompressionOrderComboBox.currentValue
+        settings.reconnectMaxDelay = reconnectMaxDelaySpinBox.value
+        settings.connectionWarmUp = connectionWarmUpCheckbox.checked
+        settings.selectiveSync = selectiveSyncCheckbox.checked
         if (typeof settings.useWebsockets !== "undefined") {
             settings.useWebsockets = useWebsocketsCheckbox.checked
         }
@@ -50,6 +54,10 @@ ScrollView {
         selfSignedCertificateCheckbox.checked = settings.allowSelfSignedCertificates
         handshakeAuthCheckbox.checked = settings.handshakeAuth
         connectionCompressionCheckbox.checked = settings.connectionCompression
+        connectionCompressionOrderComboBox.currentIndex = connectionCompressionOrderComboBox.indexOfValue(settings.connectionCompressionOrder)
+        reconnectMaxDelaySpinBox.value = settings.reconnectMaxDelay
+        connectionWarmUpCheckbox.checked = settings.connectionWarmUp
+        selectiveSyncCheckbox.checked = settings.selectiveSync
         if (typeof settings.useWebsockets !== "undefined") {
             useWebsocketsCheckbox.checked = settings.useWebsockets
         }
@@ -141,6 +149,77 @@ ScrollView {
                 checked: settings.connectionCompression
                 Layout.alignment: Qt.AlignLeft
             }
+            ColumnLayout {
+                spacing: 0
+                Label {
+                    text: "Compression algorithm"
+                }
+                Label {
+                    text: "(zstd is available since WeeChat 3.5)"
+                    font.pointSize: lith.settings.baseFontSize * 0.50
+                }
+            }
+            ComboBox {
+                id: connectionCompressionOrderComboBox
+                enabled: connectionCompressionCheckbox.checked
+                textRole: "text"
+                valueRole: "value"
+                model: [
+                    { text: "zstd, then zlib", value: "zstd:zlib" },
+                    { text: "zlib, then zstd", value: "zlib:zstd" },
+                    { text: "zlib only", value: "zlib" }
+                ]
+                Component.onCompleted: currentIndex = indexOfValue(settings.connectionCompressionOrder)
+                Layout.alignment: Qt.AlignLeft
+            }
+            ColumnLayout {
+                spacing: 0
+                Label {
+                    text: "Maximum reconnect delay"
+                }
+                Label {
+                    text: "(Seconds between attempts when the connection keeps failing)"
+                    font.pointSize: lith.settings.baseFontSize * 0.50
+                }
+            }
+            SpinBox {
+                id: reconnectMaxDelaySpinBox
+                value: settings.reconnectMaxDelay
+                from: 1
+                to: 3600
+                editable: true
+                Layout.alignment: Qt.AlignLeft
+            }
+            ColumnLayout {
+                spacing: 0
+                Label {
+                    text: "Reconnect when opened"
+                }
+                Label {
+                    text: "(Skip the wait and check the connection when Lith comes to the foreground)"
+                    font.pointSize: lith.settings.baseFontSize * 0.50
+                }
+            }
+            CheckBox {
+                id: connectionWarmUpCheckbox
+                checked: settings.connectionWarmUp
+                Layout.alignment: Qt.AlignLeft
+            }
+            ColumnLayout {
+                spacing: 0
+                Label {
+                    text: "Sync only recent buffers"
+                }
+                Label {
+                    text: "(New lines are received only for recently opened buffers and private messages, saves data with many channels)"
+                    font.pointSize: lith.settings.baseFontSize * 0.50
+                }
+            }
+            CheckBox {
+                id: selectiveSyncCheckbox
+                checked: settings.selectiveSync
+                Layout.alignment: Qt.AlignLeft
+            }
             Label {
                 visible: typeof settings.useWebsockets !== "undefined"
                 text: "Use WebSockets to connect"